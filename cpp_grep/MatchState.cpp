@@ -1,44 +1,164 @@
 #include "MatchState.h"
+#include "RegexException.h"
+
+#if __cplusplus >= 201103L || _MSVC_LANG >= 201103L
+#include <chrono>
+#else
+#include <ctime>
+#endif
 
 namespace rex
 {
+	/// <summary>
+	/// Milliseconds on a clock that only moves forward. Before C++11 there is only clock(), which counts processor time on
+	/// some platforms, but a search that's stuck backtracking is using the processor the whole time anyway
+	/// </summary>
+	static double now_ms()
+	{
+#if __cplusplus >= 201103L || _MSVC_LANG >= 201103L
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		return static_cast<double>(clock()) * 1000.0 / CLOCKS_PER_SEC;
+#endif
+	}
+
+	const size_t MatchState::NONE;
+
 	void MatchState::startNewCapture(unsigned short group, size_t startPos)
 	{
-		_groupCaps[group].push_back(PendingCap(startPos));
+		_caps.push_back(PendingCap(startPos, group, last(group)));
+		_last[group] = _caps.size() - 1;
+		_gen[group] = _generation;
+	}
+
+	/// <summary>
+	/// Undo a capture. Captures are mostly undone in the reverse order they were made, so it's usually the last one in the array
+	/// and gets popped, along with any dead ones that were waiting behind it
+	/// </summary>
+	void MatchState::kill(size_t cap)
+	{
+		_caps[cap].live = false;
+		while (!_caps.empty() && !_caps.back().live)
+		{
+			_caps.pop_back();
+		}
 	}
 
 	void MatchState::resetGroup(unsigned short group)
 	{
-		_groupCaps[group].clear();
+		for (size_t cap = last(group); cap != NONE;)
+		{
+			size_t prev = _caps[cap].prev;
+			kill(cap);
+			cap = prev;
+		}
+		_last[group] = NONE;
 	}
 
 	void MatchState::popCapture(unsigned short group)
 	{
-		_groupCaps[group].resize(_groupCaps[group].size() - 1);
+		size_t cap = last(group);
+		if (cap == NONE)
+			return;
+
+		_last[group] = _caps[cap].prev;
+		kill(cap);
 	}
 
 	void MatchState::end_capture(unsigned short group, size_t end_pos)
 	{
-		_groupCaps[group].back().set_end_pos(end_pos);
+		size_t cap = last(group);
+		if (cap != NONE)
+			_caps[cap].set_end_pos(end_pos);
+	}
+
+	size_t MatchState::capture_end(unsigned short group) const
+	{
+		const PendingCap& cap = _caps[last(group)];
+		return cap.start_pos + cap.length;
 	}
 
-	void MatchState::commit(Match& m, const string& str)
+	void MatchState::commit(Match& m, const char* str, size_t strSize)
 	{
-		for (unsigned short i = 0; i < _groupCaps.size(); i++)
+		// The array holds each group's captures in the order they were made, which is the order the Match wants them in
+		for (size_t i = 0; i < _caps.size(); i++)
 		{
-			for (unsigned short j = 0; j < _groupCaps[i].size(); j++)
+			if (_caps[i].live && _caps[i].fits(strSize))
+				m.add_group_capture(_caps[i].group, _caps[i].finish(str));
+		}
+		reset();
+	}
+
+	bool MatchState::commit_span(unsigned short group, size_t strSize, size_t& start, size_t& end)
+	{
+		// Like a Group in a Match, the span starts with the first capture and is as long as all of them together
+		bool found = false;
+		size_t length = 0;
+		for (size_t cap = last(group); cap != NONE; cap = _caps[cap].prev)
+		{
+			if (_caps[cap].fits(strSize))
 			{
-				m.add_group_capture(i, _groupCaps[i][j].finish(str));
+				found = true;
+				start = _caps[cap].start_pos;
+				length += _caps[cap].length;
 			}
 		}
+		if (found)
+			end = start + length;
+
 		reset();
+		return found;
 	}
 
 	void MatchState::reset()
 	{
-		for (size_t i = 0; i < _groupCaps.size(); i++)
+		_caps.clear();
+		_end.pos = NONE;
+		_end.exact = false;
+		if (++_generation == 0)
+		{
+			// Wrapped around, so a group last set a full cycle ago could look current
+			_gen.assign(_gen.size(), 0);
+			_generation = 1;
+		}
+	}
+
+	void MatchState::set_limits(size_t steps, unsigned int millis)
+	{
+		_step_limit = steps;
+		_time_limit = millis;
+		schedule_check();
+	}
+
+	void MatchState::begin_search()
+	{
+		_steps = 0;
+		if (_time_limit != 0)
+			_deadline = now_ms() + _time_limit;
+		schedule_check();
+	}
+
+	void MatchState::schedule_check()
+	{
+		_check_at = _time_limit != 0 ? _steps + STEPS_PER_CLOCK_CHECK : static_cast<size_t>(-1);
+		if (_step_limit != 0 && _step_limit < _check_at)
+			_check_at = _step_limit;
+	}
+
+	void MatchState::check_limits()
+	{
+		if (_step_limit != 0 && _steps >= _step_limit)
 		{
-			_groupCaps[i].clear();
+			reset();
+			throw RegexLimitException("Search went past its step limit");
 		}
+
+		if (_time_limit != 0 && now_ms() >= _deadline)
+		{
+			reset();
+			throw RegexLimitException("Search went past its time limit");
+		}
+
+		schedule_check();
 	}
 }
@@ -8,24 +8,44 @@ namespace rex
 {
 	using namespace std;
 
+	/// <summary>
+	/// The captures made so far by the match being tried. They all go into one flat array in the order they're made, with each
+	/// one linking back to the previous capture of its group, so making and undoing a capture is a push or pop at the end of
+	/// the array. The array keeps its size from one match to the next, so only a match with more captures than any before it
+	/// allocates. Each group's last capture is only valid when its generation is the current one, so reset doesn't have to visit
+	/// every group, which matters for patterns with many of them
+	/// </summary>
 	class MatchState
 	{
 	private:
+		static const size_t NONE = static_cast<size_t>(-1);
+
 		struct PendingCap
 		{
 		public:
 			size_t start_pos;
 			size_t length;
+			size_t prev;			// Index of the previous capture of the same group, or NONE
+			unsigned short group;
+			bool live;				// Cleared when the capture is undone, if it couldn't be popped off the end yet
 
-			PendingCap(size_t start = 0, size_t len = 0)
+			PendingCap(size_t start = 0, unsigned short grp = 0, size_t prv = NONE)
 			{
 				start_pos = start;
-				length = len;
+				length = 0;
+				prev = prv;
+				group = grp;
+				live = true;
+			}
+
+			Capture finish(const char* str)
+			{
+				return Capture(str, start_pos, length);
 			}
 
-			Capture finish(const string& str)
+			bool fits(size_t strSize) const
 			{
-				return Capture(start_pos, str.substr(start_pos, length));
+				return start_pos <= strSize && length <= strSize - start_pos;
 			}
 
 			void set_end_pos(size_t end_pos)
@@ -34,20 +54,153 @@ namespace rex
 			}
 		};
 
-		vector<vector<PendingCap> > _groupCaps;
+		vector<PendingCap> _caps;
+		vector<size_t> _last;			// Index of each group's last capture, when the group's generation is current
+		vector<unsigned int> _gen;
+		unsigned int _generation;
+
+		size_t last(unsigned short group) const
+		{
+			return _gen[group] == _generation ? _last[group] : NONE;
+		}
+
+		void kill(size_t cap);
+
+		// Limits on the work one search may do. The clock is only read every so many steps, since reading it costs far more than a step
+		static const size_t STEPS_PER_CLOCK_CHECK = 4096;
+
+		size_t _steps;
+		size_t _check_at;			// The step count at which the limits are checked next
+		size_t _step_limit;			// 0 for no limit
+		unsigned int _time_limit;	// Milliseconds, 0 for no limit
+		double _deadline;
+
+		void schedule_check();
+		void check_limits();
+
+	public:
+		/// <summary>
+		/// Where the sequence of atoms being matched may end. The atoms check it as they reach the end of a sequence, so a
+		/// quantifier can turn down an iteration and have its inner atoms try another way of matching instead
+		/// </summary>
+		struct EndRule
+		{
+			size_t pos;		// NONE lets the sequence end anywhere
+			bool exact;		// The sequence has to end at pos, rather than anywhere but pos
+		};
+
+	private:
+		EndRule _end;
+
+		EndRule replace_end(size_t pos, bool exact)
+		{
+			EndRule old = _end;
+			_end.pos = pos;
+			_end.exact = exact;
+			return old;
+		}
 
 	public:
 		MatchState(unsigned short groupCount = 1)
 		{
-			_groupCaps = vector<vector<PendingCap> >(groupCount);
+			_last = vector<size_t>(groupCount, NONE);
+			_gen = vector<unsigned int>(groupCount, 0);
+			_generation = 1;
+			_caps.reserve(groupCount * 2);
+			_steps = 0;
+			_step_limit = 0;
+			_time_limit = 0;
+			_deadline = 0;
+			_end.pos = NONE;
+			_end.exact = false;
+			schedule_check();
 		}
 
 		void startNewCapture(unsigned short group, size_t startPos);
 		void resetGroup(unsigned short group);
 		void popCapture(unsigned short group);
 		void end_capture(unsigned short group, size_t end_pos);
-		void commit(Match& m, const string& str);
+		size_t capture_end(unsigned short group) const;
+		/// <summary>
+		/// Move the captures into a Match, which refers to str for their text, and reset for the next match.
+		/// A capture that doesn't lie within the string is left out rather than pointing the Match past its end
+		/// </summary>
+		void commit(Match& m, const char* str, size_t strSize);
+
+		/// <summary>
+		/// Get where a group starts and ends instead of committing it to a Match, and reset for the next match
+		/// </summary>
+		/// <returns>False if the group has no capture that lies within the string</returns>
+		bool commit_span(unsigned short group, size_t strSize, size_t& start, size_t& end);
+
+		/// <summary>
+		/// Forget the captures, and the rule for where the atoms end
+		/// </summary>
 		void reset();
+
+		/// <summary>
+		/// Let the sequence of atoms about to be matched end anywhere. Each of these returns the rule it replaces, for restore_end
+		/// to put back once the sequence is done
+		/// </summary>
+		EndRule end_anywhere()
+		{
+			return replace_end(NONE, false);
+		}
+
+		/// <summary>
+		/// Only let the sequence of atoms about to be matched end at pos
+		/// </summary>
+		EndRule end_at(size_t pos)
+		{
+			return replace_end(pos, true);
+		}
+
+		/// <summary>
+		/// Let the sequence of atoms about to be matched end anywhere but pos, so it has to match something when it starts there
+		/// </summary>
+		EndRule end_not_at(size_t pos)
+		{
+			return replace_end(pos, false);
+		}
+
+		void restore_end(const EndRule& rule)
+		{
+			_end = rule;
+		}
+
+		/// <summary>
+		/// Check if the sequence of atoms being matched may end at pos
+		/// </summary>
+		bool can_end(size_t pos) const
+		{
+			return _end.pos == NONE || (pos == _end.pos) == _end.exact;
+		}
+
+		/// <summary>
+		/// Set the limits each search is held to. 0 turns a limit off
+		/// </summary>
+		/// <param name="steps">The most steps a search may take</param>
+		/// <param name="millis">The most milliseconds a search may take</param>
+		void set_limits(size_t steps, unsigned int millis);
+
+		bool limited() const
+		{
+			return _step_limit != 0 || _time_limit != 0;
+		}
+
+		/// <summary>
+		/// Start counting the steps and time of a new search
+		/// </summary>
+		void begin_search();
+
+		/// <summary>
+		/// Count one step of backtracking work. Throws RegexLimitException once the search is over its limits, with the captures cleared
+		/// </summary>
+		void step()
+		{
+			if (++_steps >= _check_at)
+				check_limits();
+		}
 	};
 }
 
@@ -29,6 +29,17 @@ namespace rex
 		virtual ~RegexException() throw() { }
 	};
 
+	/// <summary>
+	/// Thrown when a search goes past the step or time limit set on its Regex. The search was abandoned, so it's unknown whether the text matches
+	/// </summary>
+	class RegexLimitException : public RegexException
+	{
+	public:
+		RegexLimitException(string message) : RegexException(message) { }
+
+		virtual ~RegexLimitException() throw() { }
+	};
+
 	class RegexSyntaxException : public RegexException
 	{
 	private:
@@ -0,0 +1,676 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "atom.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Facts about a parsed Atom graph that let the matcher skip work before running an engine
+	/// </summary>
+	class Analysis
+	{
+	private:
+		// Longest string kept for any fact, so counted repetitions of literals don't blow up
+		static const size_t MAX_FACT = 256;
+
+		/// <summary>
+		/// Fixed strings that every match of part of a pattern has to contain
+		/// </summary>
+		struct Facts
+		{
+			bool exact;		// The atoms only ever match the one string held in left, right and in
+			string left;	// Every match starts with this
+			string right;	// Every match ends with this
+			string in;		// Every match contains this (the longest such string found)
+
+			Facts()
+			{
+				exact = false;
+			}
+
+			static Facts literal(const string& s)
+			{
+				Facts f;
+				f.exact = true;
+				f.left = f.right = f.in = s;
+				return f;
+			}
+
+			void trim()
+			{
+				if (in.size() > MAX_FACT)
+				{
+					exact = false;
+					in.resize(MAX_FACT);
+				}
+				if (left.size() > MAX_FACT)
+					left.resize(MAX_FACT);
+				if (right.size() > MAX_FACT)
+					right = right.substr(right.size() - MAX_FACT);
+			}
+		};
+
+		static const string& longest(const string& a, const string& b)
+		{
+			return b.size() > a.size() ? b : a;
+		}
+
+		static Facts concat(const Facts& a, const Facts& b)
+		{
+			if (a.exact && b.exact)
+			{
+				Facts f = Facts::literal(a.in + b.in);
+				f.trim();
+				return f;
+			}
+
+			Facts f;
+			f.left = a.exact ? a.in + b.left : a.left;
+			f.right = b.exact ? a.right + b.in : b.right;
+
+			// A match of both halves side by side contains the end of the first joined to the start of the second
+			f.in = longest(longest(a.in, b.in), a.right + b.left);
+			f.in = longest(longest(f.in, f.left), f.right);
+			f.trim();
+			return f;
+		}
+
+		/// <summary>
+		/// Check if s is part of one of the strings a branch has to contain
+		/// </summary>
+		static bool required_in(const string& s, const Facts& f)
+		{
+			return f.in.find(s) != string::npos || f.left.find(s) != string::npos || f.right.find(s) != string::npos;
+		}
+
+		/// <summary>
+		/// Find the longest string every branch of an alternation has to contain
+		/// </summary>
+		static string common_factor(const vector<Facts>& branches)
+		{
+			string best;
+			const string* sources[3] = { &branches[0].in, &branches[0].left, &branches[0].right };
+
+			for (size_t s = 0; s < 3; s++)
+			{
+				const string& src = *sources[s];
+				for (size_t len = src.size(); len > best.size(); len--)
+				{
+					for (size_t start = 0; start + len <= src.size(); start++)
+					{
+						string sub = src.substr(start, len);
+						bool everywhere = true;
+						for (size_t i = 1; i < branches.size() && everywhere; i++)
+						{
+							everywhere = required_in(sub, branches[i]);
+						}
+
+						if (everywhere)
+						{
+							best = sub;
+							break;
+						}
+					}
+				}
+			}
+
+			return best;
+		}
+
+		static Facts alternate(const vector<Facts>& branches)
+		{
+			bool same = true;
+			for (size_t i = 0; i < branches.size(); i++)
+			{
+				same = same && branches[i].exact && branches[i].in == branches[0].in;
+			}
+			if (same)
+				return branches[0];
+
+			Facts f;
+			f.left = branches[0].left;
+			f.right = branches[0].right;
+			for (size_t i = 1; i < branches.size(); i++)
+			{
+				size_t n = 0;
+				while (n < f.left.size() && n < branches[i].left.size() && f.left[n] == branches[i].left[n])
+					n++;
+				f.left.resize(n);
+
+				n = 0;
+				const string& r = branches[i].right;
+				while (n < f.right.size() && n < r.size() && f.right[f.right.size() - 1 - n] == r[r.size() - 1 - n])
+					n++;
+				f.right = f.right.substr(f.right.size() - n);
+			}
+
+			f.in = longest(longest(f.left, f.right), common_factor(branches));
+			return f;
+		}
+
+		static Facts repeat(const Facts& inner, unsigned int min, unsigned int max)
+		{
+			if (min == 0)
+				return inner.exact && inner.in.empty() ? inner : Facts();
+
+			if (inner.exact)
+			{
+				// Every repetition is the same string, so at least min copies of it are there back to back
+				string rep;
+				for (unsigned int i = 0; i < min && rep.size() <= MAX_FACT; i++)
+				{
+					rep += inner.in;
+				}
+
+				Facts f = Facts::literal(rep);
+				f.exact = min == max;
+				f.trim();
+				return f;
+			}
+
+			Facts f;
+			f.left = inner.left;
+			f.right = inner.right;
+			f.in = inner.in;
+			if (min > 1)
+				f.in = longest(f.in, inner.right + inner.left);
+			f.trim();
+			return f;
+		}
+
+		/// <summary>
+		/// The facts for an atom that matches one byte from a set. With fold, the set only has to come down to one byte once case is folded
+		/// </summary>
+		static Facts single_byte(const CharSet& set, bool fold)
+		{
+			int first = set.first();
+			if (first < 0)
+				return Facts();
+
+			unsigned char c = static_cast<unsigned char>(first);
+			for (unsigned int i = c + 1; i < 256; i++)
+			{
+				if (set.contains(static_cast<unsigned char>(i)) && (!fold || fold_u(static_cast<unsigned char>(i)) != fold_u(c)))
+					return Facts();
+			}
+
+			return Facts::literal(string(1, static_cast<char>(fold ? fold_u(c) : c)));
+		}
+
+		/// <summary>
+		/// Work out the facts for a sequence. With fold, they are about the text with its case folded, which is what a case
+		/// insensitive search for them looks at
+		/// </summary>
+		static Facts facts_of_seq(Atom* a, Atom* stop, bool fold)
+		{
+			Facts f = Facts::literal("");
+			for (; a != nullptr && a != stop; a = a->next())
+			{
+				f = concat(f, facts_of(a, fold));
+			}
+			return f;
+		}
+
+		static Facts facts_of(Atom* a, bool fold)
+		{
+			switch (a->kind())
+			{
+			case Atom::CHAR_LITERAL:
+			{
+				CharLiteral* lit = static_cast<CharLiteral*>(a);
+				if (fold)
+					return Facts::literal(string(1, static_cast<char>(fold_u(lit->value()))));
+
+				if (!lit->case_sensitive() && isalpha_u(lit->value()))
+					return Facts();
+
+				return Facts::literal(string(1, static_cast<char>(lit->value())));
+			}
+
+			case Atom::CHAR_RANGE:
+			{
+				CharSet set;
+				set.add_range(static_cast<CharRange*>(a)->min(), static_cast<CharRange*>(a)->max());
+				return single_byte(set, fold);
+			}
+
+			case Atom::CHAR_CLASS:
+				return single_byte(static_cast<CharClass*>(a)->set(), fold);
+
+			case Atom::GROUP_START:
+			case Atom::GROUP_END:
+			case Atom::BEGIN_STRING:
+			case Atom::END_STRING:
+			case Atom::BEGIN_LINE:
+			case Atom::END_LINE:
+			case Atom::WORD_BOUNDARY:
+				// Zero width, so the characters on either side still sit next to each other
+				return Facts::literal("");
+
+			case Atom::INVERSION:
+				if (static_cast<InversionAtom*>(a)->inner()->kind() == Atom::WORD_BOUNDARY)
+					return Facts::literal("");
+				return Facts();
+
+			case Atom::OR:
+			{
+				// Each branch runs up to the tail the branches share
+				const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+				vector<Facts> facts;
+				for (size_t i = 0; i < branches.size(); i++)
+				{
+					facts.push_back(facts_of_seq(branches[i], a->next(), fold));
+				}
+				return facts.empty() ? Facts() : alternate(facts);
+			}
+
+			case Atom::ATOMIC_GROUP:
+				return facts_of_seq(static_cast<AtomicGroup*>(a)->inner(), nullptr, fold);
+
+			case Atom::GREEDY_QUAN:
+			case Atom::LAZY_QUAN:
+			case Atom::POSSESSIVE_QUAN:
+			{
+				QuantifierBase* q = static_cast<QuantifierBase*>(a);
+				return repeat(facts_of_seq(q->inner(), nullptr, fold), q->min_count(), q->max_count());
+			}
+
+			default:
+				return Facts();
+			}
+		}
+
+		/// <summary>
+		/// How a sequence of atoms relates to a start anchor
+		/// </summary>
+		enum Anchor
+		{
+			ANCHORED,		// Every path hits the anchor before consuming anything
+			UNANCHORED,		// Some path consumes something first
+			PASSED			// Nothing was consumed and no anchor was found, so it depends on what comes next
+		};
+
+		static Anchor anchor_of_seq(Atom* a, Atom* stop, bool line)
+		{
+			for (; a != nullptr && a != stop; a = a->next())
+			{
+				Anchor r = anchor_of(a, line);
+				if (r != PASSED)
+					return r;
+			}
+			return PASSED;
+		}
+
+		static Anchor anchor_of(Atom* a, bool line)
+		{
+			switch (a->kind())
+			{
+			case Atom::BEGIN_STRING:
+				return ANCHORED;
+
+			case Atom::BEGIN_LINE:
+				return line ? ANCHORED : PASSED;
+
+			case Atom::GROUP_START:
+			case Atom::GROUP_END:
+			case Atom::END_STRING:
+			case Atom::END_LINE:
+			case Atom::WORD_BOUNDARY:
+				return PASSED;
+
+			case Atom::INVERSION:
+				return static_cast<InversionAtom*>(a)->inner()->kind() == Atom::WORD_BOUNDARY ? PASSED : UNANCHORED;
+
+			case Atom::OR:
+			{
+				// Branches that pass leave it to the shared tail, which also decides for the anchored ones
+				const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+				bool all = true;
+				for (size_t i = 0; i < branches.size(); i++)
+				{
+					Anchor r = anchor_of_seq(branches[i], a->next(), line);
+					if (r == UNANCHORED)
+						return UNANCHORED;
+					all = all && r == ANCHORED;
+				}
+				return all ? ANCHORED : PASSED;
+			}
+
+			case Atom::GREEDY_QUAN:
+			case Atom::LAZY_QUAN:
+			case Atom::POSSESSIVE_QUAN:
+			{
+				QuantifierBase* q = static_cast<QuantifierBase*>(a);
+				Anchor r = anchor_of_seq(q->inner(), nullptr, line);
+				if (r == UNANCHORED)
+					return UNANCHORED;
+
+				// Skipping an optional atom leaves it to what comes next
+				return q->min_count() > 0 ? r : PASSED;
+			}
+
+			case Atom::ATOMIC_GROUP:
+				return anchor_of_seq(static_cast<AtomicGroup*>(a)->inner(), nullptr, line);
+
+			default:
+				return UNANCHORED;
+			}
+		}
+
+		/// <summary>
+		/// Check if every path through a sequence ends on an end of line or end of input anchor, with nothing consumed after it
+		/// </summary>
+		/// <param name="anchored">Whether the path was already at an anchor when the sequence started</param>
+		static bool ends_of_seq(Atom* a, Atom* stop, bool anchored)
+		{
+			for (; a != nullptr && a != stop; a = a->next())
+			{
+				switch (a->kind())
+				{
+				case Atom::END_LINE:
+				case Atom::END_STRING:
+					anchored = true;
+					break;
+
+				case Atom::GROUP_START:
+				case Atom::GROUP_END:
+				case Atom::BEGIN_STRING:
+				case Atom::BEGIN_LINE:
+				case Atom::WORD_BOUNDARY:
+					break;
+
+				case Atom::OR:
+				{
+					const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+					bool all = true;
+					for (size_t i = 0; i < branches.size() && all; i++)
+					{
+						all = ends_of_seq(branches[i], a->next(), anchored);
+					}
+					anchored = all;
+					break;
+				}
+
+				case Atom::GREEDY_QUAN:
+				case Atom::LAZY_QUAN:
+				case Atom::POSSESSIVE_QUAN:
+				{
+					QuantifierBase* q = static_cast<QuantifierBase*>(a);
+					bool inner = ends_of_seq(q->inner(), nullptr, anchored);
+					anchored = q->min_count() > 0 ? inner : inner && anchored;
+					break;
+				}
+
+				case Atom::ATOMIC_GROUP:
+					anchored = ends_of_seq(static_cast<AtomicGroup*>(a)->inner(), nullptr, anchored);
+					break;
+
+				default:
+					anchored = false;
+					break;
+				}
+			}
+			return anchored;
+		}
+
+		static unsigned int add_length(unsigned int a, unsigned int b)
+		{
+			return a >= UINT32_MAX - b ? UINT32_MAX : a + b;
+		}
+
+		static unsigned int max_of_seq(Atom* a, Atom* stop)
+		{
+			unsigned int len = 0;
+			for (; a != nullptr && a != stop; a = a->next())
+			{
+				len = add_length(len, max_of(a));
+			}
+			return len;
+		}
+
+		static unsigned int max_of(Atom* a)
+		{
+			switch (a->kind())
+			{
+			case Atom::CHAR_LITERAL:
+			case Atom::CHAR_RANGE:
+			case Atom::CHAR_CLASS:
+			case Atom::ANY_CHAR:
+				return 1;
+
+			case Atom::INVERSION:
+				return static_cast<InversionAtom*>(a)->inner()->kind() == Atom::WORD_BOUNDARY ? 0 : 1;
+
+			case Atom::GROUP_START:
+			case Atom::GROUP_END:
+			case Atom::BEGIN_STRING:
+			case Atom::END_STRING:
+			case Atom::BEGIN_LINE:
+			case Atom::END_LINE:
+			case Atom::WORD_BOUNDARY:
+				return 0;
+
+			case Atom::OR:
+			{
+				const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+				unsigned int len = 0;
+				for (size_t i = 0; i < branches.size(); i++)
+				{
+					len = max(len, max_of_seq(branches[i], a->next()));
+				}
+				return len;
+			}
+
+			case Atom::GREEDY_QUAN:
+			case Atom::LAZY_QUAN:
+			case Atom::POSSESSIVE_QUAN:
+			{
+				QuantifierBase* q = static_cast<QuantifierBase*>(a);
+				unsigned int inner = max_of_seq(q->inner(), nullptr);
+				if (inner == 0 || q->max_count() == 0)
+					return 0;
+
+				return q->max_count() >= UINT32_MAX / inner ? UINT32_MAX : inner * q->max_count();
+			}
+
+			case Atom::ATOMIC_GROUP:
+				return max_of_seq(static_cast<AtomicGroup*>(a)->inner(), nullptr);
+
+			default:
+				return UINT32_MAX;
+			}
+		}
+
+		/// <summary>
+		/// Add the bytes a sequence can consume first to out
+		/// </summary>
+		/// <returns>True if the sequence can also match without consuming anything</returns>
+		static bool first_of_seq(Atom* a, Atom* stop, CharSet& out)
+		{
+			for (; a != nullptr && a != stop; a = a->next())
+			{
+				if (!first_of(a, out))
+					return false;
+			}
+			return true;
+		}
+
+		static bool first_of(Atom* a, CharSet& out)
+		{
+			switch (a->kind())
+			{
+			case Atom::CHAR_LITERAL:
+			{
+				CharLiteral* lit = static_cast<CharLiteral*>(a);
+				out.add(lit->value());
+				if (!lit->case_sensitive())
+					out.add(toupper_u(lit->value()));
+				return false;
+			}
+
+			case Atom::CHAR_RANGE:
+				out.add_range(static_cast<CharRange*>(a)->min(), static_cast<CharRange*>(a)->max());
+				return false;
+
+			case Atom::CHAR_CLASS:
+				out.add_set(static_cast<CharClass*>(a)->set());
+				return false;
+
+			case Atom::GROUP_START:
+			case Atom::GROUP_END:
+			case Atom::BEGIN_STRING:
+			case Atom::END_STRING:
+			case Atom::BEGIN_LINE:
+			case Atom::END_LINE:
+			case Atom::WORD_BOUNDARY:
+				return true;
+
+			case Atom::INVERSION:
+				if (static_cast<InversionAtom*>(a)->inner()->kind() == Atom::WORD_BOUNDARY)
+					return true;
+				out.add_range(0, 255);
+				return false;
+
+			case Atom::OR:
+			{
+				const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+				bool empty = false;
+				for (size_t i = 0; i < branches.size(); i++)
+				{
+					if (first_of_seq(branches[i], a->next(), out))
+						empty = true;
+				}
+				return empty;
+			}
+
+			case Atom::GREEDY_QUAN:
+			case Atom::LAZY_QUAN:
+			case Atom::POSSESSIVE_QUAN:
+			{
+				QuantifierBase* q = static_cast<QuantifierBase*>(a);
+				if (q->max_count() == 0)
+					return true;
+
+				bool empty = first_of_seq(q->inner(), nullptr, out);
+				return empty || q->min_count() == 0;
+			}
+
+			case Atom::ATOMIC_GROUP:
+				return first_of_seq(static_cast<AtomicGroup*>(a)->inner(), nullptr, out);
+
+			default:
+				out.add_range(0, 255);
+				return false;
+			}
+		}
+
+	public:
+		/// <summary>
+		/// Get the fixed string that every match has to start with
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		/// <param name="fold">Get the prefix of the case folded text, for searching case insensitively</param>
+		/// <returns>The prefix, or an empty string if the pattern doesn't start with a literal</returns>
+		static string literal_prefix(Atom* root, bool fold = false)
+		{
+			return facts_of_seq(root, nullptr, fold).left;
+		}
+
+		/// <summary>
+		/// Get the fixed strings that every match has to start with one of, like "ERROR" and "FATAL" in (ERROR|FATAL): .*
+		/// Only found when the pattern starts with an alternation and every branch starts with a case sensitive literal.
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		/// <returns>One string per branch, or an empty list if some branch can start with anything</returns>
+		static vector<string> prefix_literals(Atom* root)
+		{
+			vector<string> res;
+
+			Atom* a = root;
+			while (a != nullptr && (a->kind() == Atom::GROUP_START || a->kind() == Atom::GROUP_END))
+				a = a->next();
+
+			if (a == nullptr || a->kind() != Atom::OR)
+				return res;
+
+			const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+			Facts tail = facts_of_seq(a->next(), nullptr, false);
+			for (size_t i = 0; i < branches.size(); i++)
+			{
+				Facts f = facts_of_seq(branches[i], a->next(), false);
+				string left = f.exact ? concat(f, tail).left : f.left;
+				if (left.empty())
+					return vector<string>();
+
+				res.push_back(left);
+			}
+
+			return res;
+		}
+
+		/// <summary>
+		/// Get the longest fixed string that every match has to contain somewhere, like "timeout" in \d+\.\d+ ms .*timeout
+		/// Built from runs of literals, factors shared by every branch of an alternation, and quantified atoms that must match at least once.
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		/// <param name="fold">Get the literal in the case folded text, for searching case insensitively</param>
+		/// <returns>The literal, or an empty string if there isn't one</returns>
+		static string required_literal(Atom* root, bool fold = false)
+		{
+			return facts_of_seq(root, nullptr, fold).in;
+		}
+
+		/// <summary>
+		/// Get the fixed string that every match has to end with, like "connection refused" in .*connection refused
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		/// <param name="fold">Get the suffix of the case folded text, for searching case insensitively</param>
+		/// <returns>The suffix, or an empty string if the pattern doesn't end in a literal</returns>
+		static string literal_suffix(Atom* root, bool fold = false)
+		{
+			return facts_of_seq(root, nullptr, fold).right;
+		}
+
+		/// <summary>
+		/// Get the bytes a match can start with. Only matches that consume something count, so this is never about empty matches
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		static CharSet first_bytes(Atom* root)
+		{
+			CharSet set;
+			first_of_seq(root, nullptr, set);
+			return set;
+		}
+
+		/// <summary>
+		/// Check if every match has to start at the beginning of the input, or at the beginning of a line when line is set
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		static bool anchored_start(Atom* root, bool line)
+		{
+			return anchor_of_seq(root, nullptr, line) == ANCHORED;
+		}
+
+		/// <summary>
+		/// Check if every match has to end at the end of a line or the end of the input, like \d+ ms$
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		static bool anchored_end(Atom* root)
+		{
+			return ends_of_seq(root, nullptr, false);
+		}
+
+		/// <summary>
+		/// Get the longest a match can be
+		/// </summary>
+		/// <param name="root">The root atom returned by Parser::parse</param>
+		/// <returns>The length, or UINT32_MAX if it is unbounded</returns>
+		static unsigned int max_length(Atom* root)
+		{
+			return max_of_seq(root, nullptr);
+		}
+	};
+}
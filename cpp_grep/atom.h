@@ -5,6 +5,8 @@
 #include "utils.h"
 #include "defines.h"
 #include "MatchState.h"
+#include "charset.h"
+#include "runscan.h"
 
 namespace rex 
 {
@@ -22,7 +24,8 @@ namespace rex
 		unsigned int _min_length;
 
 		/// <summary>
-		/// Try to match on our next atom (if it exists) and reset it if the match fails
+		/// Try to match on our next atom (if it exists) and reset it if the match fails. At the end of a sequence, the
+		/// MatchState's rule for where the sequence may end decides instead
 		/// </summary>
 		/// <param name="current_result">The current distance this atom traveled</param>
 		/// <param name="m">The match object we're working with</param>
@@ -31,9 +34,10 @@ namespace rex
 		/// <returns>The result of all downstream atoms</returns>
 		int try_next(int current_result, const char* str, size_t strSize, size_t start_pos, MatchState& state)
 		{
+			state.step();
 			if (_next == nullptr)
 			{
-				return current_result;
+				return state.can_end(start_pos + current_result) ? current_result : -1;
 			}
 
 			int nextRes = _next->try_match(str, strSize, start_pos + current_result, state);
@@ -46,12 +50,43 @@ namespace rex
 		}
 
 	public:
+		/// <summary>
+		/// Identifies the concrete atom type, so passes that walk the graph (like the program compiler) can tell atoms apart without RTTI
+		/// </summary>
+		enum Kind
+		{
+			CHAR_LITERAL,
+			CHAR_RANGE,
+			CHAR_CLASS,
+			ANY_CHAR,
+			INVERSION,
+			OR,
+			GREEDY_QUAN,
+			LAZY_QUAN,
+			POSSESSIVE_QUAN,
+			BEGIN_STRING,
+			END_STRING,
+			BEGIN_LINE,
+			END_LINE,
+			WORD_BOUNDARY,
+			GROUP_START,
+			GROUP_END,
+			ATOMIC_GROUP
+		};
+
 		Atom(Atom* next = nullptr, unsigned int min_len = 0)
 		{
 			_next = next;
 			_min_length = min_len;
 		}
 
+		virtual Kind kind() const = 0;
+
+		Atom* next() const
+		{
+			return _next;
+		}
+
 		/// <summary>
 		/// Recursively append 'n' to the last atom in the sequence
 		/// </summary>
@@ -83,6 +118,19 @@ namespace rex
 				_next->findGroupNums(grps);
 		}
 
+		/// <summary>
+		/// Recursively find the atom that points to 'n' and clear that link, so 'n' is no longer owned by this sequence
+		/// </summary>
+		/// <param name="n">The atom to detach</param>
+		virtual void unlink(Atom* n)
+		{
+			if (_next == n)
+				_next = nullptr;
+
+			else if (_next != nullptr)
+				_next->unlink(n);
+		}
+
 		/// <summary>
 		/// Attempt to match this atom agains the input string at the start_pos
 		/// </summary>
@@ -122,18 +170,33 @@ namespace rex
 
 		CharLiteral(unsigned char c, bool caseSensitive = true, Atom* next = nullptr) : Atom(next, 1)
 		{
-			_char = !caseSensitive ? tolower_u(c) : c;
+			_char = !caseSensitive ? fold_u(c) : c;
 			_caseSensitive = caseSensitive;
 		}
 
+		Kind kind() const override
+		{
+			return CHAR_LITERAL;
+		}
+
+		unsigned char value() const
+		{
+			return _char;
+		}
+
+		bool case_sensitive() const
+		{
+			return _caseSensitive;
+		}
+
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (start_pos >= strSize)
 				return -1;
 			
 			unsigned char c = static_cast<unsigned char>(str[start_pos]);
-			if (!_caseSensitive && isupper_u(c))
-				c = tolower_u(c);
+			if (!_caseSensitive)
+				c = fold_u(c);
 
 			// This atom succeeded
 			if (c == _char)
@@ -161,6 +224,21 @@ namespace rex
 			_max = max;
 		}
 
+		Kind kind() const override
+		{
+			return CHAR_RANGE;
+		}
+
+		unsigned char min() const
+		{
+			return _min;
+		}
+
+		unsigned char max() const
+		{
+			return _max;
+		}
+
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (start_pos >= strSize)
@@ -179,11 +257,54 @@ namespace rex
 		}
 	};
 
+	/// <summary>
+	/// Match any character in a set, such as a character class, \w or \d. Case folding and negation are already applied to the set,
+	/// so a test is one bit lookup
+	/// </summary>
+	class CharClass : public Atom
+	{
+	private:
+		CharSet _set;
+
+	public:
+		CharClass(const CharSet& set, Atom* next = nullptr) : Atom(next, 1)
+		{
+			_set = set;
+		}
+
+		Kind kind() const override
+		{
+			return CHAR_CLASS;
+		}
+
+		const CharSet& set() const
+		{
+			return _set;
+		}
+
+		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
+		{
+			if (start_pos >= strSize)
+				return -1;
+
+			if (_set.contains(static_cast<unsigned char>(str[start_pos])))
+				return try_next(1, str, strSize, start_pos, state);
+
+			return -1;
+		}
+	};
+
 	/// <summary>
 	/// Match any single character (Including \r\n until multiline/singleline options are implemented)
 	/// </summary>
 	class AnyChar : public Atom
 	{
+	public:
+		Kind kind() const override
+		{
+			return ANY_CHAR;
+		}
+
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (start_pos < strSize)
@@ -197,7 +318,7 @@ namespace rex
 
 	/// <summary>
 	/// Inverts the result of a SINGLE match atom only. Using this for atoms that match variable lengths of chars will cause undefined behavior
-	/// Currently this is broken and causes the program to hang... need to research this
+	/// Negated classes and specials are built as a CharClass instead, so this is only left for \B and classes holding \b
 	/// </summary>
 	class InversionAtom : public Atom
 	{
@@ -210,18 +331,30 @@ namespace rex
 			_atom = nullptr; 
 			_step = 1;
 		}
-		InversionAtom(Atom* a, int step) : Atom(nullptr, static_cast<unsigned int>(_step))
+		InversionAtom(Atom* a, int step) : Atom(nullptr, static_cast<unsigned int>(step))
 		{
 			_atom = a;
 			_step = step;
 		}
 
+		Kind kind() const override
+		{
+			return INVERSION;
+		}
+
+		Atom* inner() const
+		{
+			return _atom;
+		}
+
 		int try_match(const char * str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (start_pos >= strSize)
 				return -1;
 
+			MatchState::EndRule outer = state.end_anywhere();
 			int r = _atom->try_match(str, strSize, start_pos, state);
+			state.restore_end(outer);
 			if (r > -1)
 				return -1;
 
@@ -270,6 +403,34 @@ namespace rex
 			}
 		}
 
+		Kind kind() const override
+		{
+			return OR;
+		}
+
+		const vector<Atom*>& branches() const
+		{
+			return _atoms;
+		}
+
+		void unlink(Atom* n) override
+		{
+			// Every branch shares our next atom, so it has to be detached from all of them
+			if (_next == n)
+			{
+				for (size_t i = 0; i < _atoms.size(); i++)
+				{
+					_atoms[i]->unlink(n);
+				}
+
+				_next = nullptr;
+			}
+			else if (_next != nullptr)
+			{
+				_next->unlink(n);
+			}
+		}
+
 		void append(Atom* next) override
 		{
 			// Only append next to each branch if this is the first Atom after the OR.
@@ -308,8 +469,12 @@ namespace rex
 
 		~OrAtom()
 		{
+			// The branches all end in our next atom, which is deleted by the base destructor. Detach it first so it is only deleted once
 			for (size_t i = 0; i < _atoms.size(); i++)
 			{
+				if (_next != nullptr)
+					_atoms[i]->unlink(_next);
+
 				delete _atoms[i];
 			}
 		}
@@ -341,6 +506,40 @@ namespace rex
 			a->findGroupNums(_sub_groups);
 		}
 
+		// The groups inside count as this atom's too, so an atomic group or quantifier around it resets them with its own
+		void findGroupNums(vector<unsigned short>& grps) override
+		{
+			grps.insert(grps.end(), _sub_groups.begin(), _sub_groups.end());
+			Atom::findGroupNums(grps);
+		}
+
+		Atom* inner() const
+		{
+			return _atom;
+		}
+
+		unsigned int min_count() const
+		{
+			return _min;
+		}
+
+		unsigned int max_count() const
+		{
+			return _max;
+		}
+
+		/// <summary>
+		/// Check if the nth iteration, counting from 1, has to match something. Past the minimum of a quantifier with no maximum,
+		/// an iteration that matches nothing would be the same one forever, so like the compiled program it's turned down, and
+		/// the inner atoms try to match something instead, like x*? does in (x*?)* rather than stopping at nothing. The iteration
+		/// that reaches the minimum may still match nothing, but it's the last one then. Every iteration of a bounded quantifier
+		/// is its own copy of the atom in the program, so any of them may match nothing
+		/// </summary>
+		bool must_advance(size_t n) const
+		{
+			return _max == UINT32_MAX && n > _min;
+		}
+
 		virtual ~QuantifierBase()
 		{
 			delete _atom;
@@ -356,6 +555,11 @@ namespace rex
 	public:
 		GreedyQuantifier(Atom* a, unsigned int min, unsigned int max) : QuantifierBase(a, min, max) { }
 
+		Kind kind() const override
+		{
+			return GREEDY_QUAN;
+		}
+
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			// First, get the maximum start_pos that our inner atom could match, so we can work our way backwards
@@ -366,11 +570,17 @@ namespace rex
 
 			while (end_positions.size() <= _max)
 			{
+				MatchState::EndRule outer = must_advance(end_positions.size()) ? state.end_not_at(last_end_pos) : state.end_anywhere();
 				int r = _atom->try_match(str, strSize, last_end_pos, state);
+				state.restore_end(outer);
 				if (r > -1)
 				{
 					last_end_pos += r;
 					end_positions.push(last_end_pos);
+
+					// Another iteration would only match nothing again, so this one is the last, see must_advance
+					if (r == 0 && must_advance(end_positions.size()))
+						break;
 				}
 				else
 				{
@@ -393,25 +603,25 @@ namespace rex
 			// If we don't have a next, then return success
 			int fin = try_next(static_cast<int>(end_positions.top() - start_pos), str, strSize, start_pos, state);	//NOTE: Always pass in the unmodified start position, because this method adds the current position to it!
 			
-			if (_next != nullptr)
-				while (fin == -1)
+			// Without a next atom this only fails when the sequence can't end here, which backing off can still fix
+			while (fin == -1)
+			{
+				if (end_positions.size() - 1 <= _min)	//Subtract one to account for starting value on stack. <= to account for the item we will pop off next
 				{
-					if (end_positions.size() - 1 <= _min)	//Subtract one to account for starting value on stack. <= to account for the item we will pop off next
-					{
-						return -1;
-					}
-
-					end_positions.pop();
+					return -1;
+				}
 
-					//Remove any sub captures that we may gave picked up
-					for (size_t i = 0; i < _sub_groups.size(); i++)
-					{
-						state.popCapture(_sub_groups[i]);
-					}
+				end_positions.pop();
 
-					fin = try_next(static_cast<int>(end_positions.top() - start_pos), str, strSize, start_pos, state);
+				//Remove any sub captures that we may gave picked up
+				for (size_t i = 0; i < _sub_groups.size(); i++)
+				{
+					state.popCapture(_sub_groups[i]);
 				}
 
+				fin = try_next(static_cast<int>(end_positions.top() - start_pos), str, strSize, start_pos, state);
+			}
+
 			if (fin == -1)
 				for (size_t i = 0; i < _sub_groups.size(); i++)
 				{
@@ -422,6 +632,40 @@ namespace rex
 		}
 	};
 
+	/// <summary>
+	/// A greedy quantifier over an atom that matches one character from a set, like \w+ or [^,]*. The whole run is measured
+	/// with one scan instead of an inner match per character, and backing off is just trying the next atom one position earlier
+	/// </summary>
+	class SetQuantifier : public GreedyQuantifier
+	{
+	private:
+		RunScanner _scanner;
+
+	public:
+		SetQuantifier(Atom* a, const CharSet& set, unsigned int min, unsigned int max) : GreedyQuantifier(a, min, max), _scanner(set) { }
+
+		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
+		{
+			size_t limit = start_pos < strSize ? strSize - start_pos : 0;
+			if (limit > _max)
+				limit = _max;
+
+			size_t run = _scanner.run(str + start_pos, limit);
+			if (run < _min)
+				return -1;
+
+			for (size_t n = run;; n--)
+			{
+				int fin = try_next(static_cast<int>(n), str, strSize, start_pos, state);
+				if (fin > -1)
+					return fin;
+
+				if (n == _min)
+					return -1;
+			}
+		}
+	};
+
 	/// <summary>
 	/// A quantifier that only attempts to match it's inner atom until it reaches the minimum required count, and its _next Atom is successful
 	/// </summary>
@@ -431,6 +675,11 @@ namespace rex
 	public:
 		LazyQuantifier(Atom* a, unsigned int min, unsigned int max) : QuantifierBase(a, min, max) {}
 
+		Kind kind() const override
+		{
+			return LAZY_QUAN;
+		}
+
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (_max <= 0)
@@ -459,12 +708,17 @@ namespace rex
 				}
 
 				// We have not reached max yet, try our inner atom again
-
+				MatchState::EndRule outer = must_advance(c + 1) ? state.end_not_at(start_pos + i) : state.end_anywhere();
 				r = _atom->try_match(str, strSize, start_pos + i, state);
+				state.restore_end(outer);
 				if (r > -1)
 				{
 					c++;
 					i += r;
+
+					// Another iteration would only match nothing again, so this one is the last, see must_advance
+					if (r == 0 && must_advance(c + 1))
+						return try_next(i, str, strSize, start_pos, state);
 				}
 				//We can't match our inner atom, so we must fail
 				else
@@ -475,6 +729,86 @@ namespace rex
 		}
 	};
 
+	/// <summary>
+	/// A quantifier that matches as much as it can, like a greedy one, but never gives any of it back when the atoms after it fail
+	/// </summary>
+	class PossessiveQuantifier : public QuantifierBase
+	{
+	private:
+		RunScanner* _scanner;	// Set when the inner atom matches one character from a set, so the run is measured in one scan
+
+		void reset_groups(MatchState& state)
+		{
+			for (size_t i = 0; i < _sub_groups.size(); i++)
+			{
+				state.resetGroup(_sub_groups[i]);
+			}
+		}
+
+	public:
+		PossessiveQuantifier(Atom* a, unsigned int min, unsigned int max, const CharSet* set = nullptr) : QuantifierBase(a, min, max)
+		{
+			_scanner = set != nullptr ? new RunScanner(*set) : nullptr;
+		}
+
+		Kind kind() const override
+		{
+			return POSSESSIVE_QUAN;
+		}
+
+		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
+		{
+			size_t end_pos = start_pos;
+			if (_scanner != nullptr)
+			{
+				size_t limit = start_pos < strSize ? strSize - start_pos : 0;
+				if (limit > _max)
+					limit = _max;
+
+				size_t run = _scanner->run(str + start_pos, limit);
+				if (run < _min)
+					return -1;
+				end_pos += run;
+			}
+			else
+			{
+				unsigned int count = 0;
+				while (count < _max)
+				{
+					MatchState::EndRule outer = must_advance(count + 1) ? state.end_not_at(end_pos) : state.end_anywhere();
+					int r = _atom->try_match(str, strSize, end_pos, state);
+					state.restore_end(outer);
+					if (r < 0)
+						break;
+
+					end_pos += r;
+					count++;
+
+					// Another iteration would only match nothing again, so this one is the last, see must_advance
+					if (r == 0 && must_advance(count + 1))
+						break;
+				}
+
+				if (count < _min)
+				{
+					reset_groups(state);
+					return -1;
+				}
+			}
+
+			int fin = try_next(static_cast<int>(end_pos - start_pos), str, strSize, start_pos, state);
+			if (fin == -1)
+				reset_groups(state);
+
+			return fin;
+		}
+
+		~PossessiveQuantifier()
+		{
+			delete _scanner;
+		}
+	};
+
 	////////////////////////
 	// Special matches
 	////////////////////////
@@ -485,6 +819,10 @@ namespace rex
 	class BeginStringAtom : public Atom
 	{
 	public:
+		Kind kind() const override
+		{
+			return BEGIN_STRING;
+		}
 
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
@@ -501,6 +839,10 @@ namespace rex
 	class EndStringAtom : public Atom
 	{
 	public:
+		Kind kind() const override
+		{
+			return END_STRING;
+		}
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (start_pos == strSize)
@@ -516,6 +858,10 @@ namespace rex
 	class BeginLineAtom : public Atom
 	{
 	public:
+		Kind kind() const override
+		{
+			return BEGIN_LINE;
+		}
 		int try_match(const char * str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			if (start_pos == 0
@@ -534,9 +880,14 @@ namespace rex
 	class EndLineAtom : public Atom
 	{
 	public:
+		Kind kind() const override
+		{
+			return END_LINE;
+		}
+
 		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
-			if (start_pos >= strSize || (start_pos + 1 < strSize && (str[start_pos + 1] == '\n' || str[start_pos + 1] == '\r')))
+			if (start_pos >= strSize || str[start_pos] == '\n' || str[start_pos] == '\r')
 				return try_next(0, str, strSize, start_pos, state);
 
 			return -1;
@@ -545,23 +896,22 @@ namespace rex
 
 	class WordBoundary : public Atom
 	{
-	private:
-		bool is_word_char(unsigned char c)
+	public:
+		Kind kind() const override
 		{
-			return c == '-' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+			return WORD_BOUNDARY;
 		}
 
-	public:
 		int try_match(const char * str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			bool is1aWord = false;
 			bool is2aWord = false;
 
 			if (start_pos > 0)
-				is1aWord = is_word_char(str[start_pos - 1]);
+				is1aWord = isword_u(str[start_pos - 1]);
 
 			if (start_pos < strSize)
-				is2aWord = is_word_char(str[start_pos]);
+				is2aWord = isword_u(str[start_pos]);
 
 			if (is1aWord != is2aWord)
 				return try_next(0, str, strSize, start_pos, state);
@@ -590,6 +940,11 @@ namespace rex
 			_group_num = groupNum;
 		}
 
+		Kind kind() const override
+		{
+			return GROUP_START;
+		}
+
 		unsigned short group_num() const
 		{
 			return _group_num;
@@ -623,6 +978,16 @@ namespace rex
 			_group_num = group_num;
 		}
 
+		Kind kind() const override
+		{
+			return GROUP_END;
+		}
+
+		unsigned short group_num() const
+		{
+			return _group_num;
+		}
+
 		int try_match(const char * str, size_t strSize, size_t start_pos, MatchState& state) override
 		{
 			int r = try_next(0,str, strSize, start_pos, state);
@@ -633,5 +998,67 @@ namespace rex
 			return r;
 		}
 	};
-}
 
+	/// <summary>
+	/// Matches its inner atoms once, and like a possessive quantifier never goes back to try them another way when the atoms after it fail
+	/// </summary>
+	class AtomicGroup : public Atom
+	{
+	private:
+		Atom* _atom;
+		vector<unsigned short> _sub_groups;
+
+	public:
+		AtomicGroup(Atom* a) : Atom(nullptr, 0)
+		{
+			_atom = a;
+			a->findGroupNums(_sub_groups);
+		}
+
+		Kind kind() const override
+		{
+			return ATOMIC_GROUP;
+		}
+
+		Atom* inner() const
+		{
+			return _atom;
+		}
+
+		unsigned int min_length() override
+		{
+			return _atom->min_length() + Atom::min_length();
+		}
+
+		void findGroupNums(vector<unsigned short>& grps) override
+		{
+			grps.insert(grps.end(), _sub_groups.begin(), _sub_groups.end());
+			Atom::findGroupNums(grps);
+		}
+
+		int try_match(const char* str, size_t strSize, size_t start_pos, MatchState& state) override
+		{
+			MatchState::EndRule outer = state.end_anywhere();
+			int r = _atom->try_match(str, strSize, start_pos, state);
+			state.restore_end(outer);
+			if (r < 0)
+				return -1;
+
+			int fin = try_next(r, str, strSize, start_pos, state);
+			if (fin == -1)
+			{
+				for (size_t i = 0; i < _sub_groups.size(); i++)
+				{
+					state.resetGroup(_sub_groups[i]);
+				}
+			}
+
+			return fin;
+		}
+
+		~AtomicGroup()
+		{
+			delete _atom;
+		}
+	};
+}
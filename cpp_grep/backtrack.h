@@ -0,0 +1,314 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "program.h"
+#include "MatchState.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Runs a compiled Program with a backtracking dispatch loop. Alternatives and capture undo records live on an explicit
+	/// stack instead of the call stack, and the program is one contiguous array, so a step is a switch on the next instruction
+	/// rather than a virtual call. Captures go into a MatchState the same way the atoms record them, so quantified groups
+	/// keep every capture.
+	/// Every (split instruction, position) pair that has been tried is marked in a bitset. Reaching one again means it already
+	/// failed, or it is an empty loop like (a*)* coming back around, so that path is dropped. This bounds the work at one visit
+	/// per pair, instead of the exponential blow up plain backtracking hits on patterns like (a|a)*b. Texts too long for the
+	/// visited set are left to the other engines. Each split also counts as a step against the MatchState's limits.
+	/// </summary>
+	class Backtracker
+	{
+	private:
+		/// <summary>
+		/// Work left on the stack: an alternative to try, or a capture change to undo when backtracking past it
+		/// </summary>
+		struct Job
+		{
+			enum Kind
+			{
+				BRANCH,
+				POP_CAPTURE,
+				RESTORE_END
+			};
+
+			enum Kind kind;
+			int pc;					// BRANCH: the instruction to resume at
+			unsigned short group;	// POP_CAPTURE and RESTORE_END
+			size_t pos;				// BRANCH: the input position. RESTORE_END: the previous end of the capture
+
+			Job(enum Kind k, int p, unsigned short g, size_t v)
+			{
+				kind = k;
+				pc = p;
+				group = g;
+				pos = v;
+			}
+		};
+
+		// The most bits the visited set may use (2MB). Longer texts are left to another engine, see supports
+		static const size_t MAX_VISITED = 1 << 24;
+
+		const Program* _prog;
+		vector<Job> _stack;
+
+		vector<unsigned int> _visited;	// One bit per (position, instruction) pair, positions counted from _base
+		size_t _touched;		// One past the highest bit set in _visited, so clearing it only costs what the last search visited
+		bool _memo;				// The visited set is in use for this search
+		const char* _memo_str;	// The text and start position of the last search, so a later start on the same text can keep the set
+		size_t _memo_size;
+		size_t _memo_start;
+		size_t _base;
+		bool _groups;			// Record the groups other than group 0 in this search
+		size_t _limit;			// Where the text ends for the instructions that consume it. For match_between, where the match has to end
+		bool _exact;			// The match has to end at _limit
+
+		/// <summary>
+		/// Mark a state as tried
+		/// </summary>
+		/// <returns>False if it was already tried</returns>
+		bool visit(int pc, size_t pos)
+		{
+			size_t bit = (pos - _base) * _prog->insts.size() + static_cast<size_t>(pc);
+			unsigned int mask = 1u << (bit & 31);
+			if (_visited[bit >> 5] & mask)
+				return false;
+
+			_visited[bit >> 5] |= mask;
+			if (bit >= _touched)
+				_touched = bit + 1;
+			return true;
+		}
+
+		/// <summary>
+		/// Set up the visited set for a search at start_pos
+		/// </summary>
+		void begin(const char* str, size_t strSize, size_t start_pos)
+		{
+			// A state that failed for an earlier start fails for this one too, because nothing but the 0 length check
+			// depends on the start, and that only applies at the earlier start position
+			if (_memo && str == _memo_str && strSize == _memo_size && start_pos > _memo_start)
+			{
+				_memo_start = start_pos;
+				return;
+			}
+
+			size_t width = _limit - start_pos + 1;
+			_memo = width <= MAX_VISITED / _prog->insts.size();
+			_memo_str = str;
+			_memo_size = strSize;
+			_memo_start = start_pos;
+			if (!_memo)
+				return;
+
+			// The positions a search visits are the ones it reaches from its start, so after a match the next search only has
+			// to clear as far as that one got, rather than the whole rest of the text
+			fill(_visited.begin(), _visited.begin() + (_touched + 31) / 32, 0u);
+			_touched = 0;
+
+			size_t words = (_prog->insts.size() * width + 31) / 32;
+			if (_visited.size() < words)
+				_visited.resize(words, 0);
+
+			_base = start_pos;
+		}
+
+		/// <summary>
+		/// Run from pc at pos until the path matches or fails
+		/// </summary>
+		bool run(int pc, size_t pos, const char* str, size_t strSize, size_t start_pos, MatchState& state)
+		{
+			const Inst* insts = &_prog->insts[0];
+
+			for (;;)
+			{
+				const Inst& in = insts[pc];
+				switch (in.op)
+				{
+				case Inst::MATCH:
+					// 0 length matches don't count, so keep looking for a longer one
+					if (pos == start_pos || (_exact && pos != _limit))
+						return false;
+
+					state.startNewCapture(0, start_pos);
+					state.end_capture(0, pos);
+					return true;
+
+				case Inst::CHAR:
+					if (pos >= _limit || static_cast<unsigned char>(str[pos]) != in.lo)
+						return false;
+					pos++;
+					break;
+
+				case Inst::RANGE:
+				{
+					unsigned char c;
+					if (pos >= _limit || (c = static_cast<unsigned char>(str[pos])) < in.lo || c > in.hi)
+						return false;
+					pos++;
+					break;
+				}
+
+				case Inst::CLASS:
+					if (pos >= _limit || !_prog->classes[in.arg].contains(static_cast<unsigned char>(str[pos])))
+						return false;
+					pos++;
+					break;
+
+				case Inst::ANY:
+					if (pos >= _limit)
+						return false;
+					pos++;
+					break;
+
+				case Inst::SPLIT:
+					if (_memo && !visit(pc, pos))
+						return false;
+
+					state.step();
+
+					_stack.push_back(Job(Job::BRANCH, in.arg, 0, pos));
+					break;
+
+				case Inst::JMP:
+					break;
+
+				case Inst::SAVE:
+				{
+					// Group 0 always spans the whole match, so it is only recorded once the match succeeds
+					if (in.arg < 2 || !_groups)
+						break;
+
+					unsigned short group = static_cast<unsigned short>(in.arg / 2);
+					if (in.arg % 2 == 0)
+					{
+						state.startNewCapture(group, pos);
+						_stack.push_back(Job(Job::POP_CAPTURE, 0, group, 0));
+					}
+					else
+					{
+						_stack.push_back(Job(Job::RESTORE_END, 0, group, state.capture_end(group)));
+						state.end_capture(group, pos);
+					}
+					break;
+				}
+
+				default:
+					if (!Program::assertion_holds(in.op, str, strSize, pos))
+						return false;
+					break;
+				}
+
+				pc = in.out;
+			}
+		}
+
+	public:
+		Backtracker(const Program* prog)
+		{
+			_prog = prog;
+			_memo = false;
+			_memo_str = nullptr;
+			_memo_size = 0;
+			_memo_start = 0;
+			_base = 0;
+			_touched = 0;
+			_groups = true;
+			_limit = 0;
+			_exact = false;
+		}
+
+		/// <summary>
+		/// Check if a search can run on a text. It needs the visited set, which has to fit in memory: programs with empty loops
+		/// would never end without it, and any other program could take exponential time
+		/// </summary>
+		bool supports(size_t strSize, size_t start_pos) const
+		{
+			return strSize - start_pos + 1 <= MAX_VISITED / _prog->insts.size();
+		}
+
+		/// <summary>
+		/// Forget the states tried so far. Until this is called, a search on the same text at a later start skips the states
+		/// earlier failed searches tried, so it has to be called whenever the text may have changed
+		/// </summary>
+		void new_text()
+		{
+			_memo_str = nullptr;
+		}
+
+		/// <summary>
+		/// Attempt to match at start_pos only, not counting 0 length matches
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The position to match at</param>
+		/// <param name="state">Receives the captures if the match succeeds. Left empty if it fails</param>
+		/// <param name="groups">Record the other groups, not just group 0</param>
+		/// <returns>True if the match succeeds</returns>
+		bool match_at(const char* str, size_t strSize, size_t start_pos, MatchState& state, bool groups = true)
+		{
+			_limit = strSize;
+			_exact = false;
+			return search(str, strSize, start_pos, state, groups);
+		}
+
+		/// <summary>
+		/// Match from start_pos to exactly end_pos, to fill in the groups of a match another engine found there. The visited set
+		/// only has to cover the match rather than the rest of the text, so filling in each match of a long text stays linear.
+		/// Check supports(end_pos, start_pos) first
+		/// </summary>
+		/// <returns>True if the match succeeds, with its captures in state</returns>
+		bool match_between(const char* str, size_t strSize, size_t start_pos, size_t end_pos, MatchState& state)
+		{
+			// The states tried depend on end_pos, so they're no use to a search of the whole text, or the other way around
+			new_text();
+			_limit = end_pos;
+			_exact = true;
+			bool found = search(str, strSize, start_pos, state, true);
+			new_text();
+			return found;
+		}
+
+	private:
+		bool search(const char* str, size_t strSize, size_t start_pos, MatchState& state, bool groups)
+		{
+			begin(str, strSize, start_pos);
+			_groups = groups;
+
+			_stack.clear();
+			if (run(0, start_pos, str, strSize, start_pos, state))
+			{
+				new_text();
+				return true;
+			}
+
+			while (!_stack.empty())
+			{
+				Job job = _stack.back();
+				_stack.pop_back();
+
+				switch (job.kind)
+				{
+				case Job::BRANCH:
+					if (run(job.pc, job.pos, str, strSize, start_pos, state))
+					{
+						new_text();
+						return true;
+					}
+					break;
+
+				case Job::POP_CAPTURE:
+					state.popCapture(job.group);
+					break;
+
+				case Job::RESTORE_END:
+					state.end_capture(job.group, job.pos);
+					break;
+				}
+			}
+
+			return false;
+		}
+	};
+}
@@ -0,0 +1,297 @@
+#pragma once
+#include <vector>
+#include <cstring>
+#include "program.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// A bit-parallel (Glushkov) matcher for patterns with at most 64 character positions, such as ERR[0-9]{3} or user=\w+
+	/// Each bit of the state is one instruction that consumes a character, set when that instruction has just matched, so
+	/// stepping over a byte is a few shifts, ands and table lookups with no backtracking and no allocation.
+	/// Only reports whether and where a match ends. Supports ^ and \A before the first character and $ and \z after the last one.
+	/// </summary>
+	class BitParallel
+	{
+	public:
+		typedef unsigned long long Bits;
+
+		static const size_t MAX_POSITIONS = 64;
+
+	private:
+		enum Anchor
+		{
+			ANCHOR_NONE,
+			ANCHOR_LINE,	// ^ or $
+			ANCHOR_STRING	// \A or \z
+		};
+
+		/// <summary>
+		/// A pending instruction while following empty transitions, with the anchors passed on the way
+		/// </summary>
+		struct Frame
+		{
+			int pc;
+			int begin;
+			int end;
+
+			Frame(int p, int b, int e)
+			{
+				pc = p;
+				begin = b;
+				end = e;
+			}
+		};
+
+		Bits _masks[256];			// The positions that accept each byte
+		Bits _first[3];				// Positions that can start a match, by the anchor that has to hold before them
+		Bits _final[3];				// Positions that can end a match, by the anchor that has to hold after them
+		Bits _follow[8][256];		// Positions that can follow any of 8 positions, one table per byte of the state
+
+		// When every position can only be followed by itself or the next one, following is just a shift
+		bool _shift;
+		Bits _shift_mask;			// Positions followed by the next position
+		Bits _loop_mask;			// Positions followed by themselves
+		size_t _chunks;
+
+		BitParallel()
+		{
+			memset(_masks, 0, sizeof(_masks));
+			memset(_first, 0, sizeof(_first));
+			memset(_final, 0, sizeof(_final));
+			memset(_follow, 0, sizeof(_follow));
+			_shift = true;
+			_shift_mask = 0;
+			_loop_mask = 0;
+			_chunks = 0;
+		}
+
+		static Bits bit(int position)
+		{
+			return static_cast<Bits>(1) << position;
+		}
+
+		/// <summary>
+		/// Collect the positions reachable from pc without consuming anything, sorted by the anchors passed on the way.
+		/// Begin anchors are only allowed from the start of the program, and nothing but the end may come after an end anchor.
+		/// </summary>
+		/// <returns>False if the program uses assertions this engine can't handle</returns>
+		static bool closure(const Program* prog, const vector<int>& position_of, int pc, bool from_start, Bits first[3], bool final[3])
+		{
+			vector<Frame> stack(1, Frame(pc, ANCHOR_NONE, ANCHOR_NONE));
+			vector<unsigned short> seen(prog->insts.size(), 0);
+
+			while (!stack.empty())
+			{
+				Frame f = stack.back();
+				stack.pop_back();
+
+				unsigned short key = static_cast<unsigned short>(1u << (f.begin * 3 + f.end));
+				if (seen[f.pc] & key)
+					continue;
+				seen[f.pc] |= key;
+
+				const Inst& in = prog->insts[f.pc];
+				switch (in.op)
+				{
+				case Inst::MATCH:
+					// A match straight from the start would be 0 length, which doesn't count
+					if (!from_start)
+						final[f.end] = true;
+					break;
+
+				case Inst::JMP:
+				case Inst::SAVE:
+					stack.push_back(Frame(in.out, f.begin, f.end));
+					break;
+
+				case Inst::SPLIT:
+					stack.push_back(Frame(in.out, f.begin, f.end));
+					stack.push_back(Frame(in.arg, f.begin, f.end));
+					break;
+
+				case Inst::CHAR:
+				case Inst::RANGE:
+				case Inst::CLASS:
+				case Inst::ANY:
+					if (f.end != ANCHOR_NONE)
+						return false;
+
+					first[f.begin] |= bit(position_of[f.pc]);
+					break;
+
+				case Inst::BEGIN_LINE:
+				case Inst::BEGIN_STRING:
+				{
+					if (!from_start || f.end != ANCHOR_NONE)
+						return false;
+
+					int anchor = in.op == Inst::BEGIN_LINE ? ANCHOR_LINE : ANCHOR_STRING;
+					stack.push_back(Frame(in.out, f.begin > anchor ? f.begin : anchor, f.end));
+					break;
+				}
+
+				case Inst::END_LINE:
+				case Inst::END_STRING:
+				{
+					int anchor = in.op == Inst::END_LINE ? ANCHOR_LINE : ANCHOR_STRING;
+					stack.push_back(Frame(in.out, f.begin, f.end > anchor ? f.end : anchor));
+					break;
+				}
+
+				default:
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		Bits follow(Bits d) const
+		{
+			if (_shift)
+				return ((d & _shift_mask) << 1) | (d & _loop_mask);
+
+			Bits res = 0;
+			for (size_t i = 0; i < _chunks && d != 0; i++, d >>= 8)
+			{
+				res |= _follow[i][d & 0xFF];
+			}
+			return res;
+		}
+
+		bool accepts(Bits d, const char* str, size_t strSize, size_t end) const
+		{
+			if (d & _final[ANCHOR_NONE])
+				return true;
+			if ((d & _final[ANCHOR_LINE]) && Program::assertion_holds(Inst::END_LINE, str, strSize, end))
+				return true;
+			return (d & _final[ANCHOR_STRING]) && end >= strSize;
+		}
+
+	public:
+		/// <summary>
+		/// Build the tables for a program
+		/// </summary>
+		/// <returns>The matcher, or null if the program has too many positions or uses unsupported assertions</returns>
+		static BitParallel* build(const Program* prog)
+		{
+			vector<int> position_of(prog->insts.size(), -1);
+			vector<int> positions;
+			for (size_t i = 0; i < prog->insts.size(); i++)
+			{
+				if (!prog->insts[i].consumes())
+					continue;
+
+				if (positions.size() >= MAX_POSITIONS)
+					return nullptr;
+
+				position_of[i] = static_cast<int>(positions.size());
+				positions.push_back(static_cast<int>(i));
+			}
+
+			BitParallel* bp = new BitParallel();
+			bp->_chunks = (positions.size() + 7) / 8;
+
+			bool unused[3];
+			if (!closure(prog, position_of, 0, true, bp->_first, unused))
+			{
+				delete bp;
+				return nullptr;
+			}
+
+			vector<Bits> follows(positions.size(), 0);
+			for (size_t p = 0; p < positions.size(); p++)
+			{
+				const Inst& in = prog->insts[positions[p]];
+				for (unsigned int c = 0; c < 256; c++)
+				{
+					if (prog->accepts(in, static_cast<unsigned char>(c)))
+						bp->_masks[c] |= bit(static_cast<int>(p));
+				}
+
+				Bits next[3] = { 0, 0, 0 };
+				bool final[3] = { false, false, false };
+				if (!closure(prog, position_of, in.out, false, next, final))
+				{
+					delete bp;
+					return nullptr;
+				}
+
+				follows[p] = next[ANCHOR_NONE];
+				for (int a = ANCHOR_NONE; a <= ANCHOR_STRING; a++)
+				{
+					if (final[a])
+						bp->_final[a] |= bit(static_cast<int>(p));
+				}
+
+				Bits self = bit(static_cast<int>(p));
+				Bits succ = p + 1 < positions.size() ? bit(static_cast<int>(p + 1)) : 0;
+				if ((follows[p] & ~(self | succ)) != 0)
+					bp->_shift = false;
+				if (follows[p] & self)
+					bp->_loop_mask |= self;
+				if (follows[p] & succ)
+					bp->_shift_mask |= self;
+			}
+
+			for (size_t chunk = 0; chunk < bp->_chunks; chunk++)
+			{
+				for (unsigned int b = 0; b < 256; b++)
+				{
+					for (size_t j = 0; j < 8 && chunk * 8 + j < positions.size(); j++)
+					{
+						if (b & (1u << j))
+							bp->_follow[chunk][b] |= follows[chunk * 8 + j];
+					}
+				}
+			}
+
+			return bp;
+		}
+
+		/// <summary>
+		/// Scan for the first position where a match ends, for a match starting at or after start_pos
+		/// </summary>
+		/// <param name="str">The string to search</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The first position a match may start at</param>
+		/// <param name="anchored">Only accept matches starting exactly at start_pos</param>
+		/// <param name="end_pos">Receives the end of the shortest, earliest ending match</param>
+		/// <returns>True if there is a match</returns>
+		bool search(const char* str, size_t strSize, size_t start_pos, bool anchored, size_t& end_pos) const
+		{
+			Bits d = 0;
+			for (size_t pos = start_pos; pos < strSize; pos++)
+			{
+				Bits start = 0;
+				if (!anchored || pos == start_pos)
+				{
+					start = _first[ANCHOR_NONE];
+					if (Program::assertion_holds(Inst::BEGIN_LINE, str, strSize, pos))
+						start |= _first[ANCHOR_LINE];
+					if (pos == 0)
+						start |= _first[ANCHOR_STRING];
+				}
+
+				d = (follow(d) | start) & _masks[static_cast<unsigned char>(str[pos])];
+				if (d == 0)
+				{
+					if (anchored)
+						break;
+					continue;
+				}
+
+				if (accepts(d, str, strSize, pos + 1))
+				{
+					end_pos = pos + 1;
+					return true;
+				}
+			}
+
+			return false;
+		}
+	};
+}
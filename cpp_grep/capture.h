@@ -24,17 +24,35 @@ namespace rex
 		virtual ~CaptureBase() {}
 	};
 
+	/// <summary>
+	/// The text one group matched. A capture made by a match only records where it is in the string that was searched, so that
+	/// string has to outlive it. Call own() to copy the text into the capture when it has to be kept for longer
+	/// </summary>
 	class Capture : public CaptureBase
 	{
 	protected:
-		string _value;
+		const char* _text;	// Points into the string that was searched, or null once the capture holds its own copy
+		string _value;		// The copy, when the capture owns its text
 		size_t _start;
+		size_t _length;
 
 	public:
 		Capture(const size_t s = 0, const string val = "")
 		{
+			_text = nullptr;
 			_start = s;
 			_value = val;
+			_length = val.length();
+		}
+
+		/// <summary>
+		/// A capture of len bytes at position s of str, which refers to str instead of copying it
+		/// </summary>
+		Capture(const char* str, size_t s, size_t len)
+		{
+			_text = str + s;
+			_start = s;
+			_length = len;
 		}
 
 		size_t start() const override
@@ -44,12 +62,37 @@ namespace rex
 
 		string value() const override
 		{
-			return _value;
+			return string(data(), _length);
 		}
 
 		size_t length() const override
 		{
-			return _value.length();
+			return _length;
+		}
+
+		/// <summary>
+		/// The captured text, which is length() bytes long and not null terminated
+		/// </summary>
+		const char* data() const
+		{
+			return _text != nullptr ? _text : _value.data();
+		}
+
+		bool owned() const
+		{
+			return _text == nullptr;
+		}
+
+		/// <summary>
+		/// Copy the captured text into the capture, so it no longer depends on the string that was searched
+		/// </summary>
+		void own()
+		{
+			if (_text != nullptr)
+			{
+				_value.assign(_text, _length);
+				_text = nullptr;
+			}
 		}
 	};
 }
@@ -0,0 +1,125 @@
+#pragma once
+#include <cstring>
+#include "utils.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// A set of byte values, stored as a 256 bit membership bitmap
+	/// </summary>
+	class CharSet
+	{
+	private:
+		unsigned int _bits[8];
+
+	public:
+		CharSet()
+		{
+			clear();
+		}
+
+		void clear()
+		{
+			memset(_bits, 0, sizeof(_bits));
+		}
+
+		void add(unsigned char c)
+		{
+			_bits[c >> 5] |= 1u << (c & 31);
+		}
+
+		void add_range(unsigned char min, unsigned char max)
+		{
+			for (unsigned int c = min; c <= max; c++)
+			{
+				add(static_cast<unsigned char>(c));
+			}
+		}
+
+		void add_set(const CharSet& other)
+		{
+			for (size_t i = 0; i < 8; i++)
+			{
+				_bits[i] |= other._bits[i];
+			}
+		}
+
+		void invert()
+		{
+			for (size_t i = 0; i < 8; i++)
+			{
+				_bits[i] = ~_bits[i];
+			}
+		}
+
+		/// <summary>
+		/// Add the other case of every letter in the set
+		/// </summary>
+		void fold_case()
+		{
+			for (unsigned int c = 'a'; c <= 'z'; c++)
+			{
+				unsigned char upper = toupper_u(static_cast<unsigned char>(c));
+				if (contains(static_cast<unsigned char>(c)) || contains(upper))
+				{
+					add(static_cast<unsigned char>(c));
+					add(upper);
+				}
+			}
+		}
+
+		bool contains(unsigned char c) const
+		{
+			return (_bits[c >> 5] >> (c & 31)) & 1u;
+		}
+
+		/// <summary>
+		/// The number of byte values in the set
+		/// </summary>
+		size_t count() const
+		{
+			size_t n = 0;
+			for (size_t i = 0; i < 8; i++)
+			{
+				for (unsigned int w = _bits[i]; w != 0; w &= w - 1)
+					n++;
+			}
+			return n;
+		}
+
+		/// <summary>
+		/// The smallest byte value in the set, or -1 if it is empty
+		/// </summary>
+		int first() const
+		{
+			for (unsigned int c = 0; c < 256; c++)
+			{
+				if (contains(static_cast<unsigned char>(c)))
+					return static_cast<int>(c);
+			}
+			return -1;
+		}
+
+		bool empty() const
+		{
+			for (size_t i = 0; i < 8; i++)
+			{
+				if (_bits[i] != 0)
+					return false;
+			}
+			return true;
+		}
+
+		bool operator==(const CharSet& other) const
+		{
+			return memcmp(_bits, other._bits, sizeof(_bits)) == 0;
+		}
+
+		bool operator!=(const CharSet& other) const
+		{
+			return !(*this == other);
+		}
+	};
+}
@@ -0,0 +1,381 @@
+#pragma once
+#include "atom.h"
+#include "program.h"
+#include "RegexException.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Lowers the Atom graph built by the Parser into a flat Program
+	/// </summary>
+	class Compiler
+	{
+	private:
+		// Large counted repetitions are copied out instruction by instruction, so the program size has to be capped
+		static const size_t MAX_INSTS = 65536;
+
+		Program* _prog;
+		unsigned int _repeat_depth;	// How many quantifiers that can repeat more than once enclose the atom being compiled
+
+		Compiler(Program* prog)
+		{
+			_prog = prog;
+			_repeat_depth = 0;
+		}
+
+		int emit(enum Inst::Op op, int out, int arg = 0, unsigned char lo = 0, unsigned char hi = 0)
+		{
+			if (_prog->insts.size() >= MAX_INSTS)
+				throw RegexException("Pattern is too large to compile");
+
+			_prog->insts.push_back(Inst(op, out, arg, lo, hi));
+			return static_cast<int>(_prog->insts.size() - 1);
+		}
+
+		int pc() const
+		{
+			return static_cast<int>(_prog->insts.size());
+		}
+
+		int add_class(const CharSet& set)
+		{
+			for (size_t i = 0; i < _prog->classes.size(); i++)
+			{
+				if (_prog->classes[i] == set)
+					return static_cast<int>(i);
+			}
+
+			_prog->classes.push_back(set);
+			return static_cast<int>(_prog->classes.size() - 1);
+		}
+
+		void emit_set(const CharSet& set)
+		{
+			int p = pc();
+			emit(Inst::CLASS, p + 1, add_class(set));
+		}
+
+		/// <summary>
+		/// Emit every atom in the sequence starting at 'a', stopping at 'stop' or the end of the sequence.
+		/// Control falls through to whatever gets emitted next.
+		/// </summary>
+		void compile_seq(Atom* a, Atom* stop)
+		{
+			if (_prog->reversed)
+			{
+				// Going backwards, every sequence runs last atom first
+				vector<Atom*> seq;
+				for (; a != nullptr && a != stop; a = a->next())
+				{
+					seq.push_back(a);
+				}
+
+				for (size_t i = seq.size(); i-- > 0;)
+				{
+					compile_one(seq[i]);
+				}
+				return;
+			}
+
+			for (; a != nullptr && a != stop; a = a->next())
+			{
+				compile_one(a);
+			}
+		}
+
+		void compile_one(Atom* a)
+		{
+			switch (a->kind())
+			{
+			case Atom::CHAR_LITERAL:
+			{
+				CharLiteral* lit = static_cast<CharLiteral*>(a);
+				if (!lit->case_sensitive() && isalpha_u(lit->value()))
+				{
+					CharSet set;
+					byte_set(a, set);
+					emit_set(set);
+				}
+				else
+					emit(Inst::CHAR, pc() + 1, 0, lit->value());
+				break;
+			}
+
+			case Atom::CHAR_RANGE:
+			{
+				CharRange* r = static_cast<CharRange*>(a);
+				emit(Inst::RANGE, pc() + 1, 0, r->min(), r->max());
+				break;
+			}
+
+			case Atom::CHAR_CLASS:
+			{
+				const CharSet& set = static_cast<CharClass*>(a)->set();
+				if (set.count() == 1)
+					emit(Inst::CHAR, pc() + 1, 0, static_cast<unsigned char>(set.first()));
+				else
+					emit_set(set);
+				break;
+			}
+
+			case Atom::ANY_CHAR:
+				emit(Inst::ANY, pc() + 1);
+				break;
+
+			case Atom::INVERSION:
+			{
+				InversionAtom* inv = static_cast<InversionAtom*>(a);
+				if (inv->inner()->kind() == Atom::WORD_BOUNDARY)
+				{
+					emit(Inst::NOT_WORD_BOUNDARY, pc() + 1);
+					break;
+				}
+
+				CharSet set;
+				if (!byte_set(a, set))
+					throw RegexException("Unsupported inversion");
+
+				emit_set(set);
+				break;
+			}
+
+			case Atom::OR:
+			{
+				CharSet set;
+				if (byte_set(a, set))
+				{
+					// Every branch is a single character, so the whole alternation is one class
+					emit_set(set);
+					break;
+				}
+
+				const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+				vector<int> jumps;
+				for (size_t i = 0; i < branches.size(); i++)
+				{
+					int split = -1;
+					if (i + 1 < branches.size())
+						split = emit(Inst::SPLIT, pc() + 1);
+
+					compile_seq(branches[i], a->next());
+
+					if (i + 1 < branches.size())
+					{
+						jumps.push_back(emit(Inst::JMP, -1));
+						_prog->insts[split].arg = pc();
+					}
+				}
+
+				for (size_t i = 0; i < jumps.size(); i++)
+				{
+					_prog->insts[jumps[i]].out = pc();
+				}
+				break;
+			}
+
+			case Atom::GREEDY_QUAN:
+			case Atom::LAZY_QUAN:
+				compile_quantifier(static_cast<QuantifierBase*>(a), a->kind() == Atom::GREEDY_QUAN);
+				break;
+
+			case Atom::BEGIN_STRING:
+				emit(Inst::BEGIN_STRING, pc() + 1);
+				break;
+
+			case Atom::END_STRING:
+				emit(Inst::END_STRING, pc() + 1);
+				break;
+
+			case Atom::BEGIN_LINE:
+				emit(Inst::BEGIN_LINE, pc() + 1);
+				break;
+
+			case Atom::END_LINE:
+				emit(Inst::END_LINE, pc() + 1);
+				break;
+
+			case Atom::WORD_BOUNDARY:
+				emit(Inst::WORD_BOUNDARY, pc() + 1);
+				break;
+
+			case Atom::GROUP_START:
+				if (_repeat_depth > 0)
+					_prog->repeated_groups = true;
+
+				emit(Inst::SAVE, pc() + 1, static_cast<GroupStart*>(a)->group_num() * 2);
+				break;
+
+			case Atom::GROUP_END:
+				emit(Inst::SAVE, pc() + 1, static_cast<GroupEnd*>(a)->group_num() * 2 + 1);
+				break;
+
+			case Atom::POSSESSIVE_QUAN:
+			case Atom::ATOMIC_GROUP:
+				// Cutting off backtracking has no equivalent in a program the VMs run on every path at once
+				throw RegexException("Possessive quantifiers and atomic groups can't be compiled");
+
+			default:
+				throw RegexException("Unsupported atom");
+			}
+		}
+
+		/// <summary>
+		/// Point a split at 'target' through the branch that is taken second for greedy quantifiers, or first for lazy ones
+		/// </summary>
+		void patch_exit(int split, int target, bool greedy)
+		{
+			if (greedy)
+				_prog->insts[split].arg = target;
+			else
+			{
+				_prog->insts[split].arg = _prog->insts[split].out;
+				_prog->insts[split].out = target;
+			}
+		}
+
+		void compile_quantifier(QuantifierBase* q, bool greedy)
+		{
+			unsigned int min = q->min_count();
+			unsigned int max = q->max_count();
+			if (max == 0)
+				return;
+
+			bool unbounded = max == UINT32_MAX;
+			if (max > 1)
+				_repeat_depth++;
+
+			// x{n,} is emitted as n-1 copies of x followed by x+
+			unsigned int copies = unbounded && min > 0 ? min - 1 : min;
+			for (unsigned int i = 0; i < copies; i++)
+			{
+				compile_seq(q->inner(), nullptr);
+			}
+
+			if (unbounded && min > 0)
+			{
+				// L: x; split L, next
+				int loop = pc();
+				compile_seq(q->inner(), nullptr);
+				int split = emit(Inst::SPLIT, loop);
+				patch_exit(split, pc(), greedy);
+			}
+			else if (unbounded)
+			{
+				// L: split L+1, next; x; jmp L
+				int split = emit(Inst::SPLIT, pc() + 1);
+				compile_seq(q->inner(), nullptr);
+				emit(Inst::JMP, split);
+				patch_exit(split, pc(), greedy);
+			}
+			else
+			{
+				// Each optional copy can skip straight to the end
+				vector<int> splits;
+				for (unsigned int i = min; i < max; i++)
+				{
+					splits.push_back(emit(Inst::SPLIT, pc() + 1));
+					compile_seq(q->inner(), nullptr);
+				}
+
+				for (size_t i = 0; i < splits.size(); i++)
+				{
+					patch_exit(splits[i], pc(), greedy);
+				}
+			}
+
+			if (max > 1)
+				_repeat_depth--;
+		}
+
+	public:
+		/// <summary>
+		/// Get the set of bytes matched by an atom that always consumes exactly one character
+		/// </summary>
+		/// <param name="a">The atom to check</param>
+		/// <param name="out">Receives the bytes the atom accepts</param>
+		/// <returns>False if the atom is not a single character matcher</returns>
+		static bool byte_set(Atom* a, CharSet& out)
+		{
+			switch (a->kind())
+			{
+			case Atom::CHAR_LITERAL:
+			{
+				CharLiteral* lit = static_cast<CharLiteral*>(a);
+				out.add(lit->value());
+				if (!lit->case_sensitive())
+					out.add(toupper_u(lit->value()));
+				return true;
+			}
+
+			case Atom::CHAR_RANGE:
+				out.add_range(static_cast<CharRange*>(a)->min(), static_cast<CharRange*>(a)->max());
+				return true;
+
+			case Atom::CHAR_CLASS:
+				out.add_set(static_cast<CharClass*>(a)->set());
+				return true;
+
+			case Atom::ANY_CHAR:
+				out.add_range(0, 255);
+				return true;
+
+			case Atom::INVERSION:
+			{
+				CharSet inner;
+				if (!byte_set(static_cast<InversionAtom*>(a)->inner(), inner))
+					return false;
+
+				inner.invert();
+				out.add_set(inner);
+				return true;
+			}
+
+			case Atom::OR:
+			{
+				// Only a single character if every branch is one, with nothing else before the shared tail
+				const vector<Atom*>& branches = static_cast<OrAtom*>(a)->branches();
+				CharSet set;
+				for (size_t i = 0; i < branches.size(); i++)
+				{
+					if (branches[i]->next() != a->next() || !byte_set(branches[i], set))
+						return false;
+				}
+
+				out.add_set(set);
+				return true;
+			}
+
+			default:
+				return false;
+			}
+		}
+
+		/// <summary>
+		/// Compile the Atom graph returned by Parser::parse
+		/// </summary>
+		/// <param name="root">The root atom of the pattern</param>
+		/// <param name="numGroups">The number of capture groups (including group 0)</param>
+		/// <param name="reverse">Compile a program that matches the pattern backwards, for finding where a match starts from where it ends</param>
+		/// <returns>The compiled program, or null if the pattern can't be lowered</returns>
+		static Program* compile(Atom* root, unsigned short numGroups, bool reverse = false)
+		{
+			Program* prog = new Program(numGroups);
+			prog->reversed = reverse;
+			try
+			{
+				Compiler c(prog);
+				c.compile_seq(root, nullptr);
+				c.emit(Inst::MATCH, -1);
+			}
+			catch (const RegexException&)
+			{
+				delete prog;
+				return nullptr;
+			}
+
+			return prog;
+		}
+	};
+}
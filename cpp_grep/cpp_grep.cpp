@@ -4,6 +4,10 @@
 #pragma once
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <climits>
 #include "regex.h"
 #include "MatchFormatter.h"
 
@@ -23,28 +27,111 @@ void print_full_match_info(string&, Match& m)
 	cout << endl;
 }
 
-int process_matches(string& pattern, istream& stream, void (*func)(string&, Match&), unsigned int max = 0)
+// What process_matches prints for the lines that match
+enum Output
+{
+	PRINT_GROUPS,	// The line, then the captures of each group
+	PRINT_LINES,	// Just the line
+	PRINT_SPANS,	// Each part of the line that matches, on a line of its own
+	PRINT_COUNT		// Only how many matches there are, once the stream is done
+};
+
+/// <summary>
+/// Print every line of the stream that matches the pattern
+/// </summary>
+/// <param name="output">What to print. Only PRINT_GROUPS needs the groups, the others let the Regex skip them</param>
+/// <param name="flags">Regex::Flags to construct the pattern with</param>
+/// <param name="caseSensitive">Set to false to match letters in either case</param>
+/// <param name="max">Stop after this many matching lines. 0 for no limit</param>
+/// <param name="steps">The most backtracking steps to spend on a line. 0 for no limit</param>
+/// <param name="millis">The most milliseconds to spend on a line. 0 for no limit</param>
+/// <returns>The number of matching lines</returns>
+int process_matches(string& pattern, istream& stream, Output output, unsigned int flags = Regex::NONE, bool caseSensitive = true, unsigned int max = 0, size_t steps = 0, unsigned int millis = 0)
 {
 	unsigned int count = 0;
+	unsigned int skipped = 0;
+	size_t total = 0;
 	size_t lineNum = 0;
 	string line;
+	Match m;	// Reused for each line, so it keeps the memory of its groups
 
 	try
 	{
-		Regex reg(pattern);
+		Regex reg(pattern, caseSensitive, flags);
+		reg.set_limits(steps, millis);
 
 		while (std::getline(stream, line) && (!max || count < max))
 		{
-			//Line was read, now see if it matches our pattern
-			Match m;
-			if (reg.match(line.data(), line.size(), m))
+			lineNum++;
+
+			try
 			{
-				count++;
-				lineNum++;
-				cout << lineNum << ": " << line << endl;
-				func(line, m);	//TODO: Accept multiple funcs
+				//Line was read, now see if it matches our pattern
+				switch (output)
+				{
+				case PRINT_LINES:
+					// Nothing needs the groups, so a yes or no is enough
+					if (reg.is_match(line.data(), line.size()))
+					{
+						count++;
+						cout << lineNum << ": " << line << endl;
+					}
+					break;
+
+				case PRINT_SPANS:
+				{
+					size_t start, end;
+					size_t pos = 0;
+					bool found = false;
+					while (pos <= line.size() && reg.find_span(line.data(), line.size(), start, end, pos))
+					{
+						found = true;
+						cout << lineNum << ": ";
+						cout.write(line.data() + start, end - start);
+						cout << endl;
+						pos = end > start ? end : start + 1;	//Always move forward by at least 1
+					}
+
+					if (found)
+						count++;
+					break;
+				}
+
+				case PRINT_COUNT:
+				{
+					size_t n = reg.count_matches(line.data(), line.size());
+					if (n > 0)
+					{
+						count++;
+						total += n;
+					}
+					break;
+				}
+
+				default:
+					m.clear();
+					if (reg.match(line.data(), line.size(), m))
+					{
+						count++;
+						cout << lineNum << ": " << line << endl;
+						print_full_match_info(line, m);
+					}
+					break;
+				}
+			}
+			catch (const RegexLimitException& reLim)
+			{
+				// Give up on this line and carry on with the rest
+				skipped++;
+				cerr << lineNum << ": " << reLim.what() << endl;
 			}
 		}
+
+		if (output == PRINT_COUNT)
+			cout << total << endl;
+
+		if (skipped > 0)
+			cerr << skipped << " line(s) skipped for going past the match limits" << endl;
 	}
 	catch (const RegexSyntaxException& reSyn)
 	{
@@ -64,38 +151,122 @@ int process_matches(string& pattern, istream& stream, void (*func)(string&, Matc
 	return count;
 }
 
+void print_usage()
+{
+	cerr << "Usage: cpp_grep [options] [--] pattern [files...]" << endl;
+	cerr << endl;
+	cerr << "Reads from standard input if no files are given." << endl;
+	cerr << endl;
+	cerr << "Options:" << endl;
+	cerr << "  -l    Only print the matching lines, without the group details" << endl;
+	cerr << "  -o    Only print the part of each line that matches, once for each match" << endl;
+	cerr << "  -c    Only print the number of matches" << endl;
+	cerr << "  -i    Ignore case" << endl;
+	cerr << "  -F    Treat the pattern as fixed strings, one per line, instead of a regex" << endl;
+	cerr << "  -b    Match with the bytecode interpreter instead of the atoms" << endl;
+	cerr << "  -j    Match with native code generated for the pattern, falling back to -b where that isn't supported" << endl;
+	cerr << "  -s N  Give up on a line after N backtracking steps, and report it" << endl;
+	cerr << "  -t N  Give up on a line after N milliseconds, and report it" << endl;
+	cerr << "  --    End of the options, for a pattern that looks like one" << endl;
+}
+
+/// <summary>
+/// Read the number given to an option like -s
+/// </summary>
+/// <returns>False if arg isn't a whole number that fits in max</returns>
+bool parse_count(const char* arg, unsigned long max, unsigned long& out)
+{
+	// strtoul would skip spaces and take a sign, and reads something like "foo" as 0, which turns a limit off
+	if (!isdigit(static_cast<unsigned char>(arg[0])))
+		return false;
+
+	char* end;
+	errno = 0;
+	out = strtoul(arg, &end, 10);
+	return *end == '\0' && errno != ERANGE && out <= max;
+}
+
 int main(int argc, char* argv[])
 {
-	// No args entered
-	if (argc == ARGC_OFFSET)
+	Output output = PRINT_GROUPS;
+	unsigned int flags = Regex::NONE;
+	bool caseSensitive = true;
+	size_t steps = 0;
+	unsigned int millis = 0;
+
+	// Read any options ahead of the pattern. They end at "--" or at the first argument that isn't one, so patterns can start with a dash
+	int argi = ARGC_OFFSET;
+	for (; argi < argc; argi++)
+	{
+		string opt(argv[argi]);
+		if (opt == "--")
+		{
+			argi++;
+			break;
+		}
+		else if (opt == "-l")
+			output = PRINT_LINES;
+		else if (opt == "-o")
+			output = PRINT_SPANS;
+		else if (opt == "-c")
+			output = PRINT_COUNT;
+		else if (opt == "-i")
+			caseSensitive = false;
+		else if (opt == "-F")
+			flags |= Regex::LITERAL;
+		else if (opt == "-b")
+			flags |= Regex::BYTECODE;
+		else if (opt == "-j")
+			flags |= Regex::JIT;
+		else if (opt == "-s" || opt == "-t")
+		{
+			unsigned long n;
+			if (argi + 1 == argc || !parse_count(argv[argi + 1], opt == "-s" ? ULONG_MAX : UINT_MAX, n))
+			{
+				cerr << "cpp_grep: " << opt << " needs a number" << endl;
+				print_usage();
+				return 2;
+			}
+
+			argi++;
+			if (opt == "-s")
+				steps = n;
+			else
+				millis = static_cast<unsigned int>(n);
+		}
+		else
+			break;
+	}
+
+	// No pattern entered
+	if (argi == argc)
 	{
-		cerr << "Help Screen HERE" << endl;
-		//Print help here
+		print_usage();
 		return 0;
 	}
 	else
 	{			
 		// Grab our pattern to match with
-		string pattern = string(argv[ARGC_OFFSET]);
+		string pattern = string(argv[argi]);
 
-		// Only one arg was specified, so we must be reading from cin
-		if (argc == ARGC_OFFSET + 1)
+		// Only the pattern was specified, so we must be reading from cin
+		if (argc == argi + 1)
 		{
-			process_matches(pattern, cin, &print_full_match_info);
+			process_matches(pattern, cin, output, flags, caseSensitive, 0, steps, millis);
 		}
 
 		// At least one file arg was specified after the pattern arg
 		// Loop through the files, open them, and pass the streams to our matching function
 		else
 		{
-			// Start with our second arg and loop though them all
-			for (int i = ARGC_OFFSET + 1; i < argc; i++)
+			// Start with the arg after the pattern and loop though them all
+			for (int i = argi + 1; i < argc; i++)
 			{
 				//TODO: Try using file patterns to match multiple files?
 				//		On guardian we might want to throw a warning if /in/ or /inv/ was specified
 
 				ifstream fstr(argv[i]);	// Default open mode is 1 (in)
-				process_matches(pattern, fstr, &print_full_match_info);
+				process_matches(pattern, fstr, output, flags, caseSensitive, 0, steps, millis);
 				fstr.close();
 			}
 		}
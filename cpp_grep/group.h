@@ -18,6 +18,14 @@ namespace rex
 			return _captures[capnum];
 		}
 
+		/// <summary>
+		/// Get a capture without copying it
+		/// </summary>
+		const Capture& capture(const size_t capnum) const
+		{
+			return _captures[capnum];
+		}
+
 		void add_capture(const Capture cap)
 		{
 			_captures.push_back(cap);
@@ -53,6 +61,14 @@ namespace rex
 			return _captures.size();
 		}
 
+		/// <summary>
+		/// Remove the captures, keeping the memory they used for the next ones
+		/// </summary>
+		void clear()
+		{
+			_captures.clear();
+		}
+
 		Capture last_capture() const
 		{
 			if (_captures.size() == 0)
@@ -65,5 +81,16 @@ namespace rex
 		{
 			return last_capture().value();
 		}
+
+		/// <summary>
+		/// Copy the text of each capture into it. See Capture::own
+		/// </summary>
+		void own()
+		{
+			for (size_t i = 0; i < _captures.size(); i++)
+			{
+				_captures[i].own();
+			}
+		}
 	};
 }
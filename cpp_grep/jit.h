@@ -0,0 +1,634 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include "program.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define REX_JIT_X64
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Compiles a Program into native x86-64 code that backtracks in the same order as the Backtracker.
+	/// The generated code only works out where a match ends; the interpreter fills in the groups afterwards.
+	/// Like the interpreter, each split marks its (instruction, position) pair in a visited set and drops a path that reaches
+	/// one again, which bounds the work at one visit per pair. Texts too long for the set are left to the interpreter.
+	/// On other platforms, or where executable memory can't be mapped, compile returns null so the caller can fall back.
+	/// </summary>
+	class Jit
+	{
+	public:
+		enum Result
+		{
+			NOT_FOUND,
+			FOUND,
+			GAVE_UP		// The backtrack stack hit its limit, or the text is too long for the visited set. Use another engine for this input
+		};
+
+	private:
+		// Most backtrack entries the generated code may use (each entry is two words)
+		static const size_t MAX_STACK_ENTRIES = 16 * 1024 * 1024;
+
+		// The most bits the visited set may use (2MB), the same as the Backtracker's
+		static const size_t MAX_VISITED = 1 << 24;
+
+		// Returned by the generated code when the backtrack stack is full
+		static const size_t OVERFLOW_POS = static_cast<size_t>(-2);
+
+		/// <summary>
+		/// Arguments passed to the generated code through a single pointer, so both calling conventions can share one prologue
+		/// </summary>
+		struct Args
+		{
+			const char* str;
+			size_t str_size;
+			size_t start_pos;
+			size_t* stack;
+			size_t* stack_limit;	// The last entry that can be pushed without overflowing
+			size_t* visited;		// One bit per (position, instruction) pair, positions counted from base
+			size_t base;
+			size_t touched;			// One past the highest bit set in visited, kept up to date by the generated code
+		};
+
+		typedef size_t (*MatchFn)(Args*);
+
+		void* _code;
+		size_t _code_size;
+		vector<unsigned char> _tables;	// A 256 byte lookup table per character class, then one for word characters
+		vector<size_t> _stack;
+		size_t _insts;
+
+		vector<size_t> _visited;
+		size_t _touched;
+		const char* _memo_str;	// The text and start position of the last search, so a later start on the same text can keep the set
+		size_t _memo_size;
+		size_t _memo_start;
+		size_t _base;
+
+#ifdef REX_JIT_X64
+		/// <summary>
+		/// Emits machine code into a buffer, with rel32 jumps to labels that are patched once every label is bound
+		/// </summary>
+		class Assembler
+		{
+		private:
+			struct Fixup
+			{
+				size_t at;
+				int label;
+			};
+
+			vector<unsigned char> _code;
+			vector<size_t> _labels;
+			vector<Fixup> _fixups;
+
+		public:
+			enum Cond
+			{
+				JB = 0x82,
+				JAE = 0x83,
+				JE = 0x84,
+				JNE = 0x85,
+				JBE = 0x86,
+				JA = 0x87
+			};
+
+			int new_label()
+			{
+				_labels.push_back(NO_POS);
+				return static_cast<int>(_labels.size() - 1);
+			}
+
+			void bind(int label)
+			{
+				_labels[label] = _code.size();
+			}
+
+			void bytes(const char* b, size_t n)
+			{
+				_code.insert(_code.end(), reinterpret_cast<const unsigned char*>(b), reinterpret_cast<const unsigned char*>(b) + n);
+			}
+
+			void byte(unsigned int b)
+			{
+				_code.push_back(static_cast<unsigned char>(b));
+			}
+
+			void imm32(unsigned int v)
+			{
+				for (int i = 0; i < 4; i++)
+				{
+					byte((v >> (i * 8)) & 0xFF);
+				}
+			}
+
+			void imm64(const void* p)
+			{
+				size_t v = reinterpret_cast<size_t>(p);
+				for (int i = 0; i < 8; i++)
+				{
+					byte((v >> (i * 8)) & 0xFF);
+				}
+			}
+
+			void rel32(int label)
+			{
+				Fixup f;
+				f.at = _code.size();
+				f.label = label;
+				_fixups.push_back(f);
+				imm32(0);
+			}
+
+			void jmp(int label)
+			{
+				byte(0xE9);
+				rel32(label);
+			}
+
+			void jcc(enum Cond cond, int label)
+			{
+				byte(0x0F);
+				byte(cond);
+				rel32(label);
+			}
+
+			/// <summary>
+			/// Patch every jump and return the finished code
+			/// </summary>
+			const vector<unsigned char>& finish()
+			{
+				for (size_t i = 0; i < _fixups.size(); i++)
+				{
+					size_t at = _fixups[i].at;
+					unsigned int rel = static_cast<unsigned int>(_labels[_fixups[i].label] - (at + 4));
+					for (int b = 0; b < 4; b++)
+					{
+						_code[at + b] = static_cast<unsigned char>((rel >> (b * 8)) & 0xFF);
+					}
+				}
+				return _code;
+			}
+		};
+
+		// Register use in the generated code:
+		//   r8  = str, r9 = str_size, rcx = start_pos, rax = current position
+		//   r10 = backtrack stack top, r11 = backtrack stack limit, rbx = Args, for the visited set
+		//   rdx, rsi, rdi = scratch (rsi, rdi and rbx are saved, since Win64 treats them as callee saved)
+		// Each backtrack entry is the code address to resume at and the position to resume with.
+
+		void emit_bounds_check(Assembler& a, int fail)
+		{
+			a.bytes("\x4C\x39\xC8", 3);						// cmp rax, r9
+			a.jcc(Assembler::JAE, fail);
+		}
+
+		void emit_load_byte(Assembler& a)
+		{
+			a.bytes("\x41\x0F\xB6\x14\x00", 5);				// movzx edx, byte [r8 + rax]
+		}
+
+		void emit_table_test(Assembler& a, const unsigned char* table, int fail)
+		{
+			a.bytes("\x48\xBA", 2);							// mov rdx, table
+			a.imm64(table);
+			a.bytes("\x41\x0F\xB6\x34\x00", 5);				// movzx esi, byte [r8 + rax]
+			a.bytes("\x80\x3C\x32\x00", 4);					// cmp byte [rdx + rsi], 0
+			a.jcc(Assembler::JE, fail);
+		}
+
+		void emit_inc_pos(Assembler& a)
+		{
+			a.bytes("\x48\xFF\xC0", 3);						// inc rax
+		}
+
+		void emit_word_boundary(Assembler& a, bool want_boundary, int fail)
+		{
+			int before_done = a.new_label();
+			int after_done = a.new_label();
+
+			a.bytes("\x48\xBA", 2);							// mov rdx, word table
+			a.imm64(&_tables[_tables.size() - 256]);
+			a.bytes("\x31\xF6", 2);							// xor esi, esi
+			a.bytes("\x31\xFF", 2);							// xor edi, edi
+			a.bytes("\x48\x85\xC0", 3);						// test rax, rax
+			a.jcc(Assembler::JE, before_done);
+			a.bytes("\x41\x0F\xB6\x7C\x00\xFF", 6);			// movzx edi, byte [r8 + rax - 1]
+			a.bytes("\x0F\xB6\x34\x3A", 4);					// movzx esi, byte [rdx + rdi]
+			a.bytes("\x31\xFF", 2);							// xor edi, edi
+			a.bind(before_done);
+			a.bytes("\x4C\x39\xC8", 3);						// cmp rax, r9
+			a.jcc(Assembler::JAE, after_done);
+			a.bytes("\x41\x0F\xB6\x3C\x00", 5);				// movzx edi, byte [r8 + rax]
+			a.bytes("\x0F\xB6\x3C\x3A", 4);					// movzx edi, byte [rdx + rdi]
+			a.bind(after_done);
+			a.bytes("\x39\xFE", 2);							// cmp esi, edi
+			a.jcc(want_boundary ? Assembler::JE : Assembler::JNE, fail);
+		}
+
+		/// <summary>
+		/// Generate the code for a whole program
+		/// </summary>
+		void generate(const Program* prog, Assembler& a)
+		{
+			int n = static_cast<int>(prog->insts.size());
+			for (int i = 0; i < n; i++)
+			{
+				a.new_label();	// Label i is instruction i
+			}
+
+			int fail = a.new_label();
+			int fail_exit = a.new_label();
+			int overflow = a.new_label();
+			int epilogue = a.new_label();
+
+			// Prologue
+			a.bytes("\x56\x57\x53", 3);						// push rsi; push rdi; push rbx
+#if defined(_WIN32)
+			a.bytes("\x48\x89\xCA", 3);						// mov rdx, rcx
+#else
+			a.bytes("\x48\x89\xFA", 3);						// mov rdx, rdi
+#endif
+			a.bytes("\x48\x89\xD3", 3);						// mov rbx, rdx
+			a.bytes("\x4C\x8B\x02", 3);						// mov r8, [rdx]
+			a.bytes("\x4C\x8B\x4A\x08", 4);					// mov r9, [rdx + 8]
+			a.bytes("\x48\x8B\x4A\x10", 4);					// mov rcx, [rdx + 16]
+			a.bytes("\x4C\x8B\x52\x18", 4);					// mov r10, [rdx + 24]
+			a.bytes("\x4C\x8B\x5A\x20", 4);					// mov r11, [rdx + 32]
+
+			// The bottom entry resumes at fail_exit, so running out of alternatives ends the search
+			a.bytes("\x48\x8D\x05", 3);						// lea rax, [rip + fail_exit]
+			a.rel32(fail_exit);
+			a.bytes("\x49\x89\x02", 3);						// mov [r10], rax
+			a.bytes("\x49\x83\xC2\x10", 4);					// add r10, 16
+			a.bytes("\x48\x89\xC8", 3);						// mov rax, rcx
+
+			for (int pc = 0; pc < n; pc++)
+			{
+				const Inst& in = prog->insts[pc];
+				a.bind(pc);
+
+				switch (in.op)
+				{
+				case Inst::MATCH:
+					// 0 length matches don't count, so keep backtracking for a longer one
+					a.bytes("\x48\x39\xC8", 3);				// cmp rax, rcx
+					a.jcc(Assembler::JE, fail);
+					a.jmp(epilogue);
+					continue;
+
+				case Inst::CHAR:
+					emit_bounds_check(a, fail);
+					emit_load_byte(a);
+					a.bytes("\x81\xFA", 2);					// cmp edx, lo
+					a.imm32(in.lo);
+					a.jcc(Assembler::JNE, fail);
+					emit_inc_pos(a);
+					break;
+
+				case Inst::RANGE:
+					emit_bounds_check(a, fail);
+					emit_load_byte(a);
+					a.bytes("\x81\xEA", 2);					// sub edx, lo
+					a.imm32(in.lo);
+					a.bytes("\x81\xFA", 2);					// cmp edx, hi - lo
+					a.imm32(static_cast<unsigned int>(in.hi - in.lo));
+					a.jcc(Assembler::JA, fail);
+					emit_inc_pos(a);
+					break;
+
+				case Inst::CLASS:
+					emit_bounds_check(a, fail);
+					emit_table_test(a, &_tables[in.arg * 256], fail);
+					emit_inc_pos(a);
+					break;
+
+				case Inst::ANY:
+					emit_bounds_check(a, fail);
+					emit_inc_pos(a);
+					break;
+
+				case Inst::SPLIT:
+				{
+					// Drop the path if this split was already tried at this position
+					int untouched = a.new_label();
+					a.bytes("\x48\x89\xC6", 3);				// mov rsi, rax
+					a.bytes("\x48\x2B\x73\x30", 4);			// sub rsi, [rbx + base]
+					a.bytes("\x48\x69\xF6", 3);				// imul rsi, rsi, insts
+					a.imm32(static_cast<unsigned int>(n));
+					a.bytes("\x48\x81\xC6", 3);				// add rsi, pc
+					a.imm32(static_cast<unsigned int>(pc));
+					a.bytes("\x48\x8B\x7B\x28", 4);			// mov rdi, [rbx + visited]
+					a.bytes("\x48\x0F\xAB\x37", 4);			// bts [rdi], rsi
+					a.jcc(Assembler::JB, fail);
+					a.bytes("\x48\x8D\x56\x01", 4);			// lea rdx, [rsi + 1]
+					a.bytes("\x48\x3B\x53\x38", 4);			// cmp rdx, [rbx + touched]
+					a.jcc(Assembler::JBE, untouched);
+					a.bytes("\x48\x89\x53\x38", 4);			// mov [rbx + touched], rdx
+					a.bind(untouched);
+
+					a.bytes("\x4D\x39\xDA", 3);				// cmp r10, r11
+					a.jcc(Assembler::JA, overflow);
+					a.bytes("\x48\x8D\x15", 3);				// lea rdx, [rip + arg]
+					a.rel32(in.arg);
+					a.bytes("\x49\x89\x12", 3);				// mov [r10], rdx
+					a.bytes("\x49\x89\x42\x08", 4);			// mov [r10 + 8], rax
+					a.bytes("\x49\x83\xC2\x10", 4);			// add r10, 16
+					break;
+				}
+
+				case Inst::JMP:
+				case Inst::SAVE:
+					// Groups are filled in by the interpreter once the match is known
+					break;
+
+				case Inst::BEGIN_STRING:
+					a.bytes("\x48\x85\xC0", 3);				// test rax, rax
+					a.jcc(Assembler::JNE, fail);
+					break;
+
+				case Inst::END_STRING:
+					a.bytes("\x4C\x39\xC8", 3);				// cmp rax, r9
+					a.jcc(Assembler::JB, fail);
+					break;
+
+				case Inst::BEGIN_LINE:
+				{
+					int ok = a.new_label();
+					a.bytes("\x48\x85\xC0", 3);				// test rax, rax
+					a.jcc(Assembler::JE, ok);
+					a.bytes("\x41\x80\x7C\x00\xFF\x0A", 6);	// cmp byte [r8 + rax - 1], '\n'
+					a.jcc(Assembler::JNE, fail);
+					a.bind(ok);
+					break;
+				}
+
+				case Inst::END_LINE:
+				{
+					int ok = a.new_label();
+					a.bytes("\x4C\x39\xC8", 3);				// cmp rax, r9
+					a.jcc(Assembler::JAE, ok);
+					emit_load_byte(a);
+					a.bytes("\x81\xFA", 2);					// cmp edx, '\n'
+					a.imm32('\n');
+					a.jcc(Assembler::JE, ok);
+					a.bytes("\x81\xFA", 2);					// cmp edx, '\r'
+					a.imm32('\r');
+					a.jcc(Assembler::JNE, fail);
+					a.bind(ok);
+					break;
+				}
+
+				case Inst::WORD_BOUNDARY:
+				case Inst::NOT_WORD_BOUNDARY:
+					emit_word_boundary(a, in.op == Inst::WORD_BOUNDARY, fail);
+					break;
+				}
+
+				if (in.out != pc + 1)
+					a.jmp(in.out);
+			}
+
+			// Backtrack: pop the top entry and resume there
+			a.bind(fail);
+			a.bytes("\x49\x83\xEA\x10", 4);					// sub r10, 16
+			a.bytes("\x49\x8B\x42\x08", 4);					// mov rax, [r10 + 8]
+			a.bytes("\x41\xFF\x22", 3);						// jmp [r10]
+
+			a.bind(fail_exit);
+			a.bytes("\x48\xC7\xC0\xFF\xFF\xFF\xFF", 7);		// mov rax, -1
+			a.jmp(epilogue);
+
+			a.bind(overflow);
+			a.bytes("\x48\xC7\xC0\xFE\xFF\xFF\xFF", 7);		// mov rax, -2
+
+			a.bind(epilogue);
+			a.bytes("\x5B\x5F\x5E\xC3", 4);					// pop rbx; pop rdi; pop rsi; ret
+		}
+
+		static void* map_code(const vector<unsigned char>& code)
+		{
+#if defined(_WIN32)
+			void* mem = VirtualAlloc(nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+			if (mem == nullptr)
+				return nullptr;
+
+			memcpy(mem, &code[0], code.size());
+			DWORD old;
+			if (!VirtualProtect(mem, code.size(), PAGE_EXECUTE_READ, &old))
+			{
+				VirtualFree(mem, 0, MEM_RELEASE);
+				return nullptr;
+			}
+			FlushInstructionCache(GetCurrentProcess(), mem, code.size());
+			return mem;
+#else
+			void* mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (mem == MAP_FAILED)
+				return nullptr;
+
+			memcpy(mem, &code[0], code.size());
+			if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0)
+			{
+				munmap(mem, code.size());
+				return nullptr;
+			}
+			return mem;
+#endif
+		}
+
+		static void unmap_code(void* mem, size_t size)
+		{
+#if defined(_WIN32)
+			(void)size;
+			VirtualFree(mem, 0, MEM_RELEASE);
+#else
+			munmap(mem, size);
+#endif
+		}
+#endif
+
+		Jit()
+		{
+			_code = nullptr;
+			_code_size = 0;
+			_stack = vector<size_t>(2 * 1024, 0);
+			_insts = 0;
+			_memo_str = nullptr;
+			_memo_size = 0;
+			_memo_start = 0;
+			_base = 0;
+			_touched = 0;
+		}
+
+		/// <summary>
+		/// Set up the visited set for a search at start_pos, the same way the Backtracker does
+		/// </summary>
+		/// <returns>False if the text is too long for the set</returns>
+		bool begin(const char* str, size_t strSize, size_t start_pos)
+		{
+			// A state that failed for an earlier start fails for this one too, see Backtracker::begin
+			if (str == _memo_str && strSize == _memo_size && start_pos > _memo_start)
+			{
+				_memo_start = start_pos;
+				return true;
+			}
+
+			new_text();
+			size_t width = strSize - start_pos + 1;
+			if (width > MAX_VISITED / _insts)
+				return false;
+
+			// Only as far as the last search got needs clearing, see Backtracker::begin
+			fill(_visited.begin(), _visited.begin() + (_touched + 63) / 64, static_cast<size_t>(0));
+			_touched = 0;
+
+			size_t words = (_insts * width + 63) / 64;
+			if (_visited.size() < words)
+				_visited.resize(words, 0);
+
+			_memo_str = str;
+			_memo_size = strSize;
+			_memo_start = start_pos;
+			_base = start_pos;
+			return true;
+		}
+
+		// The generated code holds pointers into the tables, so it can't be copied
+		Jit(const Jit&);
+		Jit& operator=(const Jit&);
+
+	public:
+		/// <summary>
+		/// Check if this build can generate native code at all
+		/// </summary>
+		static bool available()
+		{
+#ifdef REX_JIT_X64
+			return true;
+#else
+			return false;
+#endif
+		}
+
+		/// <summary>
+		/// Generate native code for a program
+		/// </summary>
+		/// <returns>The compiled matcher, or null if the JIT isn't available here or can't run the program</returns>
+		static Jit* compile(const Program* prog)
+		{
+#ifdef REX_JIT_X64
+			Jit* jit = new Jit();
+			jit->_insts = prog->insts.size();
+
+			// The tables have to be in place before the code takes their addresses
+			jit->_tables = vector<unsigned char>((prog->classes.size() + 1) * 256, 0);
+			for (size_t i = 0; i < prog->classes.size(); i++)
+			{
+				for (unsigned int c = 0; c < 256; c++)
+				{
+					jit->_tables[i * 256 + c] = prog->classes[i].contains(static_cast<unsigned char>(c)) ? 1 : 0;
+				}
+			}
+			for (unsigned int c = 0; c < 256; c++)
+			{
+				jit->_tables[prog->classes.size() * 256 + c] = isword_u(static_cast<unsigned char>(c)) ? 1 : 0;
+			}
+
+			Assembler a;
+			jit->generate(prog, a);
+			const vector<unsigned char>& code = a.finish();
+
+			jit->_code = map_code(code);
+			if (jit->_code == nullptr)
+			{
+				delete jit;
+				return nullptr;
+			}
+
+			jit->_code_size = code.size();
+			return jit;
+#else
+			(void)prog;
+			return nullptr;
+#endif
+		}
+
+		/// <summary>
+		/// Forget the states tried so far. Until this is called, a search on the same text at a later start skips the states
+		/// earlier failed searches tried, so it has to be called whenever the text may have changed
+		/// </summary>
+		void new_text()
+		{
+			_memo_str = nullptr;
+		}
+
+		/// <summary>
+		/// Attempt to match at start_pos only, not counting 0 length matches
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The position to match at</param>
+		/// <param name="end_pos">Receives the end of the match</param>
+		Result match_at(const char* str, size_t strSize, size_t start_pos, size_t& end_pos)
+		{
+			for (;;)
+			{
+				if (!begin(str, strSize, start_pos))
+					return GAVE_UP;
+
+				Args args;
+				args.str = str;
+				args.str_size = strSize;
+				args.start_pos = start_pos;
+				args.stack = &_stack[0];
+				args.stack_limit = &_stack[_stack.size() - 2];
+				args.visited = &_visited[0];
+				args.base = _base;
+				args.touched = _touched;
+
+				size_t r = reinterpret_cast<MatchFn>(_code)(&args);
+				_touched = args.touched;
+				if (r == NO_POS)
+					return NOT_FOUND;
+
+				// The states a search tried only all failed if it found nothing, so the set has to start over after anything else
+				new_text();
+				if (r != OVERFLOW_POS)
+				{
+					end_pos = r;
+					return FOUND;
+				}
+
+				// Ran out of backtrack stack. Grow it and start over
+				if (_stack.size() / 2 >= MAX_STACK_ENTRIES)
+					return GAVE_UP;
+
+				_stack = vector<size_t>(_stack.size() * 2, 0);
+			}
+		}
+
+		~Jit()
+		{
+#ifdef REX_JIT_X64
+			if (_code != nullptr)
+				unmap_code(_code, _code_size);
+#endif
+		}
+	};
+}
@@ -0,0 +1,576 @@
+#pragma once
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "program.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// A DFA built from a compiled Program one state at a time while it scans. Each state is the ordered set of NFA
+	/// instructions that are alive at a position, so once a transition has been computed it is a single table lookup.
+	/// States are cached up to a memory budget. When the budget runs out the cache is thrown away and rebuilt, and if that
+	/// keeps happening the search gives up so the caller can fall back to another engine.
+	/// Only reports where matches end, it never tracks captures.
+	/// A reversed program is scanned right to left instead, to find where matches start.
+	/// A pattern set program is scanned for every pattern that matches, which each state records by the MATCH instructions' ids.
+	/// </summary>
+	class LazyDFA
+	{
+	public:
+		enum Result
+		{
+			NOT_FOUND,
+			FOUND,
+			GAVE_UP		// The state cache kept filling up. Use another engine for this input
+		};
+
+	private:
+		enum
+		{
+			// Transition table values for transitions that haven't been computed, or that lead nowhere
+			UNKNOWN = -2,
+			DEAD = -1
+		};
+
+		enum
+		{
+			// Kernel markers that stand for "start a new thread here". START_LOOP carries over to every following state (unanchored searches)
+			START_ONCE = -1,
+			START_LOOP = -2
+		};
+
+		// What the byte on one side of a position looks like, for evaluating assertions
+		enum Context
+		{
+			CTX_EDGE = 1,		// Beginning or end of the input
+			CTX_NEWLINE = 2,	// \n
+			CTX_RETURN = 4,		// \r
+			CTX_WORD = 8
+		};
+
+		// Bytes scanned per state created since the last cache reset, below which the DFA is considered to be thrashing
+		static const size_t MIN_BYTES_PER_STATE = 10;
+
+		struct State
+		{
+			size_t kernel_start;
+			size_t kernel_size;
+			size_t ids_start;		// The ids of the MATCH instructions that were reached, in _match_ids
+			size_t ids_count;
+			int before;				// Context of the byte before this position
+			bool match;				// The transition into this state found a match ending one byte back
+		};
+
+		const Program* _prog;
+		size_t _max_memory;
+		size_t _memory;
+		bool _assertions;
+		bool _keep_all;				// A match doesn't cut off any other thread
+		size_t _num_ids;			// How many MATCH instructions there are, so a pattern set scan can stop once it has seen them all
+
+		unsigned short _classes[256];
+		vector<unsigned char> _class_rep;	// A byte belonging to each class
+		vector<int> _class_ctx;				// The context of each class. The last class is the end of the input
+		size_t _stride;
+
+		vector<State> _states;
+		vector<int> _kernels;
+		vector<int> _match_ids;
+		vector<int> _trans;
+		map<vector<int>, int> _cache;
+		int _start_states[2][16];	// The state each kind of scan starts in, by the context before it. UNKNOWN until it's built
+
+		// Scratch space for building states
+		vector<unsigned int> _seen;
+		unsigned int _gen;
+		vector<int> _stack;
+		vector<int> _list;
+		vector<bool> _fresh;
+		vector<int> _next;
+		vector<int> _matched;
+		vector<unsigned int> _id_seen;
+		vector<int> _key;
+
+		int context_of(unsigned char c) const
+		{
+			// Without assertions the context never matters, so leave it out and let more states be shared
+			if (!_assertions)
+				return 0;
+
+			int ctx = 0;
+			if (c == '\n')
+				ctx |= CTX_NEWLINE;
+			if (c == '\r')
+				ctx |= CTX_RETURN;
+			if (isword_u(c))
+				ctx |= CTX_WORD;
+			return ctx;
+		}
+
+		void build_classes()
+		{
+			size_t count = _prog->byte_classes(_classes, _assertions);
+			_class_rep = vector<unsigned char>(count, 0);
+			_class_ctx = vector<int>(count + 1, 0);
+
+			for (unsigned int c = 256; c-- > 0;)
+			{
+				_class_rep[_classes[c]] = static_cast<unsigned char>(c);
+				_class_ctx[_classes[c]] = context_of(static_cast<unsigned char>(c));
+			}
+
+			_class_ctx[count] = CTX_EDGE;
+			_stride = count + 1;
+		}
+
+		void next_gen()
+		{
+			if (++_gen == 0)
+			{
+				_seen.assign(_seen.size(), 0);
+				_gen = 1;
+			}
+		}
+
+		bool holds(enum Inst::Op op, int before, int after) const
+		{
+			// Scanning right to left, the byte seen last is the one after the position
+			if (_prog->reversed)
+				swap(before, after);
+
+			switch (op)
+			{
+			case Inst::BEGIN_LINE:
+				return (before & (CTX_EDGE | CTX_NEWLINE)) != 0;
+			case Inst::END_LINE:
+				return (after & (CTX_EDGE | CTX_NEWLINE | CTX_RETURN)) != 0;
+			case Inst::BEGIN_STRING:
+				return (before & CTX_EDGE) != 0;
+			case Inst::END_STRING:
+				return (after & CTX_EDGE) != 0;
+			case Inst::WORD_BOUNDARY:
+				return ((before & CTX_WORD) != 0) != ((after & CTX_WORD) != 0);
+			case Inst::NOT_WORD_BOUNDARY:
+				return ((before & CTX_WORD) != 0) == ((after & CTX_WORD) != 0);
+			default:
+				return false;
+			}
+		}
+
+		/// <summary>
+		/// Follow empty transitions from pc in priority order, appending the instructions that consume input or match to out.
+		/// Assertions are resolved if a context is given (after >= 0), otherwise they are kept in out to be resolved later.
+		/// </summary>
+		void follow(int pc, vector<int>& out, int before, int after, bool fresh, vector<bool>* fresh_out)
+		{
+			_stack.clear();
+			_stack.push_back(pc);
+
+			while (!_stack.empty())
+			{
+				pc = _stack.back();
+				_stack.pop_back();
+
+				if (_seen[pc] == _gen)
+					continue;
+				_seen[pc] = _gen;
+
+				const Inst& in = _prog->insts[pc];
+				switch (in.op)
+				{
+				case Inst::JMP:
+				case Inst::SAVE:
+					_stack.push_back(in.out);
+					break;
+
+				case Inst::SPLIT:
+					_stack.push_back(in.arg);
+					_stack.push_back(in.out);
+					break;
+
+				default:
+					if (in.is_assertion() && after >= 0)
+					{
+						if (holds(in.op, before, after))
+							_stack.push_back(in.out);
+					}
+					else
+					{
+						out.push_back(pc);
+						if (fresh_out != nullptr)
+							fresh_out->push_back(fresh);
+					}
+					break;
+				}
+			}
+		}
+
+		/// <summary>
+		/// Find the state for a kernel, creating it if needed
+		/// </summary>
+		/// <param name="ids">The ids of the MATCH instructions reached on the way into the state</param>
+		/// <returns>The state's index, DEAD if the kernel can never match, or UNKNOWN if the cache is full</returns>
+		int find_state(const vector<int>& kernel, int before, const vector<int>& ids)
+		{
+			if (kernel.empty() && ids.empty())
+				return DEAD;
+
+			_key.clear();
+			_key.push_back(before);
+			_key.push_back(static_cast<int>(ids.size()));
+			_key.insert(_key.end(), ids.begin(), ids.end());
+			_key.insert(_key.end(), kernel.begin(), kernel.end());
+
+			map<vector<int>, int>::iterator it = _cache.find(_key);
+			if (it != _cache.end())
+				return it->second;
+
+			size_t cost = _stride * sizeof(int) + sizeof(State) + (kernel.size() + ids.size()) * sizeof(int) * 2 + 64;
+			if (_memory + cost > _max_memory)
+				return UNKNOWN;
+
+			State s;
+			s.kernel_start = _kernels.size();
+			s.kernel_size = kernel.size();
+			s.ids_start = _match_ids.size();
+			s.ids_count = ids.size();
+			s.before = before;
+			s.match = !ids.empty();
+
+			_kernels.insert(_kernels.end(), kernel.begin(), kernel.end());
+			_match_ids.insert(_match_ids.end(), ids.begin(), ids.end());
+			_trans.insert(_trans.end(), _stride, UNKNOWN);
+			_states.push_back(s);
+			_memory += cost;
+
+			int id = static_cast<int>(_states.size() - 1);
+			_cache[_key] = id;
+			return id;
+		}
+
+		/// <summary>
+		/// Work out where state s goes on byte class cls
+		/// </summary>
+		int compute(int s, size_t cls)
+		{
+			int before = _states[s].before;
+			int after = _class_ctx[cls];
+			bool at_end = cls == _stride - 1;
+
+			// Resolve the assertions and start markers in the kernel into the list of live instructions, in priority order
+			_list.clear();
+			_fresh.clear();
+			next_gen();
+			int marker = 0;
+			for (size_t i = 0; i < _states[s].kernel_size; i++)
+			{
+				int pc = _kernels[_states[s].kernel_start + i];
+				if (pc < 0)
+				{
+					follow(0, _list, before, after, true, &_fresh);
+					marker = pc;
+				}
+				else if (_prog->insts[pc].is_assertion())
+					follow(pc, _list, before, after, false, &_fresh);
+				else if (_seen[pc] != _gen)
+				{
+					_seen[pc] = _gen;
+					_list.push_back(pc);
+					_fresh.push_back(false);
+				}
+			}
+
+			// Step every instruction over the byte. A match cuts off every lower priority thread, including new starts.
+			// A reversed program is after the furthest start rather than the first one, and a pattern set after every pattern, so they keep every thread going
+			_next.clear();
+			_matched.clear();
+			next_gen();
+			for (size_t i = 0; i < _list.size(); i++)
+			{
+				const Inst& in = _prog->insts[_list[i]];
+				if (in.op == Inst::MATCH)
+				{
+					// Threads that haven't consumed anything would be 0 length matches
+					if (_fresh[i])
+						continue;
+
+					if (_id_seen[in.arg] != _gen)
+					{
+						_id_seen[in.arg] = _gen;
+						_matched.push_back(in.arg);
+					}
+
+					if (_keep_all)
+						continue;
+
+					marker = 0;
+					break;
+				}
+
+				if (!at_end && _prog->accepts(in, _class_rep[cls]))
+					follow(in.out, _next, 0, -1, false, nullptr);
+			}
+
+			if (marker == START_LOOP)
+				_next.push_back(START_LOOP);
+
+			return find_state(_next, at_end ? CTX_EDGE : after, _matched);
+		}
+
+		/// <summary>
+		/// Throw away every cached state except the one the scan is currently in
+		/// </summary>
+		int reset_cache(int keep)
+		{
+			vector<int> kernel(_kernels.begin() + _states[keep].kernel_start, _kernels.begin() + _states[keep].kernel_start + _states[keep].kernel_size);
+			vector<int> ids(_match_ids.begin() + _states[keep].ids_start, _match_ids.begin() + _states[keep].ids_start + _states[keep].ids_count);
+			int before = _states[keep].before;
+
+			clear();
+			return find_state(kernel, before, ids);
+		}
+
+		/// <summary>
+		/// Look up or compute the transition from s on cls. If the cache has to be reset, s is moved to the rebuilt copy of its state
+		/// </summary>
+		/// <returns>The next state, DEAD, or UNKNOWN if the search should give up</returns>
+		int transition(int& s, size_t cls, size_t pos, size_t& reset_pos, size_t& states_at_reset)
+		{
+			int ns = _trans[s * _stride + cls];
+			if (ns != UNKNOWN)
+				return ns;
+
+			ns = compute(s, cls);
+			if (ns == UNKNOWN)
+			{
+				// Out of memory. Give up if the cache isn't paying for itself, otherwise start the cache over
+				if (pos - reset_pos < (_states.size() - states_at_reset) * MIN_BYTES_PER_STATE)
+					return UNKNOWN;
+
+				s = reset_cache(s);
+				reset_pos = pos;
+				states_at_reset = _states.size();
+
+				ns = compute(s, cls);
+				if (ns == UNKNOWN)
+					return UNKNOWN;
+			}
+
+			_trans[s * _stride + cls] = ns;
+			return ns;
+		}
+
+		/// <summary>
+		/// Find the state a scan starts in
+		/// </summary>
+		int start_state(int marker, int before)
+		{
+			int& cached = _start_states[marker == START_LOOP ? 1 : 0][before];
+			if (cached != UNKNOWN)
+				return cached;
+
+			vector<int> start(1, marker);
+			vector<int> ids;
+			int s = find_state(start, before, ids);
+			if (s == UNKNOWN)
+			{
+				clear();
+				s = find_state(start, before, ids);
+			}
+
+			cached = s;
+			return s;
+		}
+
+	public:
+		LazyDFA(const Program* prog, size_t max_memory = 2 * 1024 * 1024)
+		{
+			_prog = prog;
+			_max_memory = max_memory;
+			_memory = 0;
+			_seen = vector<unsigned int>(prog->insts.size(), 0);
+			_gen = 0;
+
+			_assertions = prog->has_assertions();
+			_keep_all = prog->reversed || prog->pattern_set;
+
+			int max_id = 0;
+			_num_ids = 0;
+			for (size_t i = 0; i < prog->insts.size(); i++)
+			{
+				if (prog->insts[i].op == Inst::MATCH)
+				{
+					max_id = max(max_id, prog->insts[i].arg);
+					_num_ids++;
+				}
+			}
+			_id_seen = vector<unsigned int>(static_cast<size_t>(max_id) + 1, 0);
+
+			build_classes();
+			clear();
+		}
+
+		void clear()
+		{
+			_states.clear();
+			_kernels.clear();
+			_match_ids.clear();
+			_trans.clear();
+			_cache.clear();
+			_memory = 0;
+
+			for (size_t i = 0; i < 2; i++)
+			{
+				for (size_t j = 0; j < 16; j++)
+				{
+					_start_states[i][j] = UNKNOWN;
+				}
+			}
+		}
+
+		/// <summary>
+		/// Scan for a match starting at or after start_pos
+		/// </summary>
+		/// <param name="str">The string to search</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The first position a match may start at</param>
+		/// <param name="anchored">Only accept matches starting exactly at start_pos</param>
+		/// <param name="earliest">Stop as soon as any match is seen, instead of finding where the leftmost match ends</param>
+		/// <param name="end_pos">Receives the end of the match</param>
+		Result search(const char* str, size_t strSize, size_t start_pos, bool anchored, bool earliest, size_t& end_pos)
+		{
+			int before = start_pos == 0 ? CTX_EDGE : context_of(static_cast<unsigned char>(str[start_pos - 1]));
+			int s = start_state(anchored ? START_ONCE : START_LOOP, before);
+
+			Result res = NOT_FOUND;
+			size_t states_at_reset = _states.size();
+			size_t reset_pos = start_pos;
+
+			for (size_t pos = start_pos; pos <= strSize; pos++)
+			{
+				size_t cls = pos < strSize ? _classes[static_cast<unsigned char>(str[pos])] : _stride - 1;
+				int ns = transition(s, cls, pos, reset_pos, states_at_reset);
+				if (ns == UNKNOWN)
+				{
+					clear();
+					return GAVE_UP;
+				}
+
+				if (ns == DEAD)
+					break;
+
+				s = ns;
+				if (_states[s].match)
+				{
+					end_pos = pos;
+					res = FOUND;
+					if (earliest)
+						break;
+				}
+			}
+
+			return res;
+		}
+
+		/// <summary>
+		/// Scan a reversed program from end_pos back to min_pos for the leftmost position a match starts at
+		/// </summary>
+		/// <param name="str">The string to search</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="end_pos">The last position a match may end at</param>
+		/// <param name="min_pos">The first position a match may start at</param>
+		/// <param name="anchored">Only accept matches ending exactly at end_pos</param>
+		/// <param name="start_pos">Receives the start of the leftmost match</param>
+		Result search_reverse(const char* str, size_t strSize, size_t end_pos, size_t min_pos, bool anchored, size_t& start_pos)
+		{
+			int before = end_pos == strSize ? CTX_EDGE : context_of(static_cast<unsigned char>(str[end_pos]));
+			int s = start_state(anchored ? START_ONCE : START_LOOP, before);
+
+			Result res = NOT_FOUND;
+			size_t states_at_reset = _states.size();
+			size_t reset_pos = 0;
+
+			// The transition on the byte before pos finds the matches starting at pos
+			for (size_t pos = end_pos; pos >= min_pos; pos--)
+			{
+				size_t cls = pos > 0 ? _classes[static_cast<unsigned char>(str[pos - 1])] : _stride - 1;
+				int ns = transition(s, cls, end_pos - pos, reset_pos, states_at_reset);
+				if (ns == UNKNOWN)
+				{
+					clear();
+					return GAVE_UP;
+				}
+
+				if (ns == DEAD)
+					break;
+
+				s = ns;
+				if (_states[s].match)
+				{
+					start_pos = pos;
+					res = FOUND;
+				}
+
+				if (pos == 0)
+					break;
+			}
+
+			return res;
+		}
+
+		/// <summary>
+		/// Scan a pattern set program for the patterns that match anywhere in the string
+		/// </summary>
+		/// <param name="str">The string to search</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="first_only">Stop at the first pattern found</param>
+		/// <param name="found">Flags the patterns found so far, by index. Patterns already flagged aren't reported again</param>
+		/// <param name="ids">Receives the index of each pattern found</param>
+		/// <returns>FOUND or NOT_FOUND, or GAVE_UP if the state cache kept filling up. The patterns found before giving up are still reported</returns>
+		Result search_set(const char* str, size_t strSize, bool first_only, vector<bool>& found, vector<size_t>& ids)
+		{
+			size_t count = 0;
+			int s = start_state(START_LOOP, CTX_EDGE);
+
+			size_t states_at_reset = _states.size();
+			size_t reset_pos = 0;
+
+			for (size_t pos = 0; pos <= strSize && count < _num_ids; pos++)
+			{
+				size_t cls = pos < strSize ? _classes[static_cast<unsigned char>(str[pos])] : _stride - 1;
+				int ns = transition(s, cls, pos, reset_pos, states_at_reset);
+				if (ns == UNKNOWN)
+				{
+					clear();
+					return GAVE_UP;
+				}
+
+				if (ns == DEAD)
+					break;
+
+				s = ns;
+				if (!_states[s].match)
+					continue;
+
+				for (size_t i = 0; i < _states[s].ids_count; i++)
+				{
+					size_t id = static_cast<size_t>(_match_ids[_states[s].ids_start + i]);
+					if (!found[id])
+					{
+						found[id] = true;
+						ids.push_back(id);
+						count++;
+					}
+				}
+
+				if (first_only && count > 0)
+					break;
+			}
+
+			return count > 0 ? FOUND : NOT_FOUND;
+		}
+	};
+}
@@ -90,6 +90,24 @@ namespace rex
 							tok.type = Token::LAZY_RANGE_QUAN;
 					}
 
+					// Check for the possessive modifier. {n}+ is the range {n,n} that never gives anything back
+					else if (i < pattern.size() && pattern[i] == '+')
+					{
+						tok.originalText.push_back('+');
+						i++;
+						len++;
+
+						if (tok.type == Token::STATIC_QUAN)
+						{
+							val = val + "," + val;
+							tok.type = Token::POSSESSIVE_RANGE_QUAN;
+						}
+						else if (tok.type == Token::GREEDY_MIN_QUAN)
+							tok.type = Token::POSSESSIVE_MIN_QUAN;
+						else
+							tok.type = Token::POSSESSIVE_RANGE_QUAN;
+					}
+
 					tok.value = val;
 
 					end_token(toks, tok);
@@ -392,6 +410,11 @@ namespace rex
 						tok.set_text("(?:");
 						i += 2;
 					}
+					else if (i + 2 < pattern.length() && pattern[i + 1] == '?' && pattern[i + 2] == '>')
+					{
+						tok.set_text("(?>");
+						i += 2;
+					}
 					else
 					{
 						tok.set_text("(");
@@ -453,6 +476,12 @@ namespace rex
 						tok.type = Token::LAZY_PLUS;
 						i++;
 					}
+					else if (i + 1 < pattern.length() && pattern[i + 1] == '+')
+					{
+						tok.set_text("++");
+						tok.type = Token::POSSESSIVE_PLUS;
+						i++;
+					}
 					else
 					{
 						tok.set_text("+");
@@ -471,6 +500,12 @@ namespace rex
 						tok.type = Token::LAZY_STAR;
 						i++;
 					}
+					else if (i + 1 < pattern.length() && pattern[i + 1] == '+')
+					{
+						tok.set_text("*+");
+						tok.type = Token::POSSESSIVE_STAR;
+						i++;
+					}
 					else
 					{
 						tok.set_text("*");
@@ -489,6 +524,12 @@ namespace rex
 						tok.type = Token::LAZY_Q_MARK;
 						i++;
 					}
+					else if (i + 1 < pattern.length() && pattern[i + 1] == '+')
+					{
+						tok.set_text("?+");
+						tok.type = Token::POSSESSIVE_Q_MARK;
+						i++;
+					}
 					else
 					{
 						tok.set_text("?");
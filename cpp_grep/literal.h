@@ -0,0 +1,270 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstring>
+#include "program.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REX_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Finds occurrences of a fixed string. With SSE2, 16 candidate positions at a time are filtered by comparing the two
+	/// needle bytes least likely to show up in text, and only positions where both line up are compared in full.
+	/// Without it, long needles use Boyer-Moore-Horspool and short ones memchr on the rarest byte.
+	/// A case insensitive searcher keeps its needle folded. The two cases of an ASCII letter only differ in bit 0x20, so
+	/// setting that bit in the text bytes compared against a letter lets the same filter match either case.
+	/// </summary>
+	class LiteralSearcher
+	{
+	private:
+		// Needles at least this long use Horspool when SSE2 isn't available
+		static const size_t HORSPOOL_MIN = 16;
+
+		string _needle;
+		bool _fold;				// Match ASCII letters in either case. Only set when the needle has letters
+		size_t _rare;			// Offset of the needle byte least likely to be in the text
+		size_t _rare2;			// Offset of the next least likely byte, at a different offset
+		vector<size_t> _shift;	// Horspool skip for each byte value, only built when Horspool is used
+
+		/// <summary>
+		/// Rough guess at how common a byte is in text, higher is more common
+		/// </summary>
+		static int byte_rank(unsigned char c)
+		{
+			static const char common[] = "etaoinsrhldcumfpgwybvkxjqz";
+
+			if (c == ' ')
+				return 255;
+			if (islower_u(c))
+				return 250 - static_cast<int>(strchr(common, c) - common) * 4;
+			if (isdigit_u(c))
+				return 120;
+			if (isupper_u(c))
+				return 100;
+			if (c == '\t' || c == '.' || c == ',' || c == '-' || c == '_' || c == ':' || c == '/' || c == '=')
+				return 90;
+			return 10;
+		}
+
+		int rank_at(size_t i) const
+		{
+			return byte_rank(static_cast<unsigned char>(_needle[i]));
+		}
+
+		/// <summary>
+		/// Check if the needle is at p
+		/// </summary>
+		bool equal_at(const char* p) const
+		{
+			if (!_fold)
+				return memcmp(p, _needle.data(), _needle.size()) == 0;
+
+			for (size_t i = 0; i < _needle.size(); i++)
+			{
+				if (fold_u(static_cast<unsigned char>(p[i])) != static_cast<unsigned char>(_needle[i]))
+					return false;
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Find the needle by testing the rarest byte at each position, for a case insensitive needle where that byte is a letter
+		/// </summary>
+		size_t find_folded(const char* str, size_t strSize, size_t from) const
+		{
+			size_t len = _needle.size();
+			unsigned char rare = static_cast<unsigned char>(_needle[_rare]);
+
+			for (size_t pos = from; pos + len <= strSize; pos++)
+			{
+				if (fold_u(static_cast<unsigned char>(str[pos + _rare])) == rare && equal_at(str + pos))
+					return pos;
+			}
+
+			return NO_POS;
+		}
+
+		size_t find_memchr(const char* str, size_t strSize, size_t from) const
+		{
+			size_t len = _needle.size();
+			const char* needle = _needle.data();
+			unsigned char rare = static_cast<unsigned char>(needle[_rare]);
+			if (_fold && isalpha_u(rare))
+				return find_folded(str, strSize, from);
+
+			for (size_t pos = from; pos + len <= strSize;)
+			{
+				const void* hit = memchr(str + pos + _rare, rare, strSize - len + 1 - pos);
+				if (hit == nullptr)
+					return NO_POS;
+
+				pos = static_cast<const char*>(hit) - str - _rare;
+				if (equal_at(str + pos))
+					return pos;
+				pos++;
+			}
+
+			return NO_POS;
+		}
+
+		size_t find_horspool(const char* str, size_t strSize, size_t from) const
+		{
+			size_t len = _needle.size();
+			unsigned char last = static_cast<unsigned char>(_needle[len - 1]);
+
+			for (size_t pos = from; pos + len <= strSize; pos += _shift[static_cast<unsigned char>(str[pos + len - 1])])
+			{
+				unsigned char c = static_cast<unsigned char>(str[pos + len - 1]);
+				if ((_fold ? fold_u(c) : c) == last && equal_at(str + pos))
+					return pos;
+			}
+
+			return NO_POS;
+		}
+
+#ifdef REX_SSE2
+		size_t find_sse2(const char* str, size_t strSize, size_t from) const
+		{
+			size_t len = _needle.size();
+			const char* needle = _needle.data();
+			const __m128i first = _mm_set1_epi8(needle[_rare]);
+			const __m128i second = _mm_set1_epi8(needle[_rare2]);
+
+			// Bit 0x20 is set in the text bytes compared against a letter of a case insensitive needle
+			const __m128i fold_first = _mm_set1_epi8(_fold && isalpha_u(needle[_rare]) ? 0x20 : 0);
+			const __m128i fold_second = _mm_set1_epi8(_fold && isalpha_u(needle[_rare2]) ? 0x20 : 0);
+
+			// Each block tests the 16 start positions pos to pos + 15, which all need to leave room for the needle
+			size_t pos = from;
+			for (; pos + 16 + len <= strSize + 1; pos += 16)
+			{
+				__m128i a = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos + _rare)), fold_first);
+				__m128i b = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos + _rare2)), fold_second);
+				unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, second))));
+
+				for (size_t bit = 0; mask != 0; bit++, mask >>= 1)
+				{
+					if ((mask & 1u) && equal_at(str + pos + bit))
+						return pos + bit;
+				}
+			}
+
+			// Fewer than 16 start positions left
+			return find_memchr(str, strSize, pos);
+		}
+#endif
+
+	public:
+		LiteralSearcher()
+		{
+			_fold = false;
+			_rare = 0;
+			_rare2 = 0;
+		}
+
+		/// <param name="needle">The string to find</param>
+		/// <param name="caseSensitive">Set to false to match ASCII letters in either case</param>
+		LiteralSearcher(const string& needle, bool caseSensitive = true)
+		{
+			_needle = needle;
+			_fold = false;
+			for (size_t i = 0; i < needle.size() && !caseSensitive; i++)
+			{
+				_needle[i] = static_cast<char>(fold_u(static_cast<unsigned char>(needle[i])));
+				_fold = _fold || isalpha_u(static_cast<unsigned char>(needle[i]));
+			}
+
+			_rare = 0;
+			_rare2 = needle.size() > 1 ? 1 : 0;
+
+			for (size_t i = 1; i < needle.size(); i++)
+			{
+				if (rank_at(i) < rank_at(_rare))
+					_rare = i;
+			}
+			for (size_t i = 0; i < needle.size(); i++)
+			{
+				if (i != _rare && (_rare2 == _rare || rank_at(i) < rank_at(_rare2)))
+					_rare2 = i;
+			}
+
+#ifndef REX_SSE2
+			if (needle.size() >= HORSPOOL_MIN)
+			{
+				_shift = vector<size_t>(256, needle.size());
+				for (size_t i = 0; i + 1 < needle.size(); i++)
+				{
+					unsigned char c = static_cast<unsigned char>(_needle[i]);
+					_shift[c] = needle.size() - 1 - i;
+					if (_fold)
+						_shift[toupper_u(c)] = needle.size() - 1 - i;
+				}
+			}
+#endif
+		}
+
+		bool empty() const
+		{
+			return _needle.empty();
+		}
+
+		/// <summary>
+		/// The string searched for, with its case folded if the search is case insensitive
+		/// </summary>
+		const string& needle() const
+		{
+			return _needle;
+		}
+
+		/// <summary>
+		/// Find the first occurrence of the needle starting at or after from
+		/// </summary>
+		/// <returns>The position of the occurrence, or NO_POS</returns>
+		size_t find(const char* str, size_t strSize, size_t from) const
+		{
+			if (_needle.empty())
+				return from <= strSize ? from : NO_POS;
+
+			if (_needle.size() == 1)
+				return find_memchr(str, strSize, from);
+
+#ifdef REX_SSE2
+			return find_sse2(str, strSize, from);
+#else
+			if (!_shift.empty())
+				return find_horspool(str, strSize, from);
+			return find_memchr(str, strSize, from);
+#endif
+		}
+
+		/// <summary>
+		/// Find the last occurrence of the needle starting at or after from
+		/// </summary>
+		/// <returns>The position of the occurrence, or NO_POS</returns>
+		size_t rfind(const char* str, size_t strSize, size_t from) const
+		{
+			if (_needle.empty())
+				return from <= strSize ? strSize : NO_POS;
+
+			size_t len = _needle.size();
+			if (len > strSize || from > strSize - len)
+				return NO_POS;
+
+			unsigned char rare = static_cast<unsigned char>(_needle[_rare]);
+			for (size_t pos = strSize - len + 1; pos-- > from;)
+			{
+				unsigned char c = static_cast<unsigned char>(str[pos + _rare]);
+				if ((_fold ? fold_u(c) : c) == rare && equal_at(str + pos))
+					return pos;
+			}
+
+			return NO_POS;
+		}
+	};
+}
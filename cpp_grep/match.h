@@ -13,12 +13,26 @@ namespace rex
 	class Match : public CaptureBase
 	{
 	private:
-		vector<Group> _groups;
+		vector<Group> _groups;	// Can hold more groups than are in use, kept empty by clear() for the next match
+		size_t _used;			// The number of groups in use
 
 	public:
+		Match()
+		{
+			_used = 0;
+		}
+
 		Group get_group(unsigned short groupnum) const
 		{
-			if (groupnum >= _groups.size())
+			return group(groupnum);
+		}
+
+		/// <summary>
+		/// Get a group without copying it
+		/// </summary>
+		const Group& group(unsigned short groupnum) const
+		{
+			if (groupnum >= _used)
 			{
 				throw RegexException("Group number is too high");
 			}
@@ -26,19 +40,27 @@ namespace rex
 			return _groups[groupnum];
 		}
 
+		/// <summary>
+		/// The number of groups, counting group 0, up to the highest one that captured something
+		/// </summary>
+		size_t total_groups() const
+		{
+			return _used;
+		}
+
 		size_t start() const override
 		{
-			return _groups.empty() ? 0 : _groups[0].start();
+			return _used == 0 ? 0 : _groups[0].start();
 		}
 
 		size_t length() const override
 		{
-			return get_group(0).length();
+			return group(0).length();
 		}
 
 		string value() const override
 		{
-			return get_group(0).value();
+			return group(0).value();
 		}
 
 		/// <summary>
@@ -49,7 +71,7 @@ namespace rex
 		string get_group_value(const unsigned short groupnum) const
 		{
 
-			if (groupnum >= _groups.size())
+			if (groupnum >= _used)
 				return string();
 
 			else
@@ -61,13 +83,41 @@ namespace rex
 			while (groupNum >= _groups.size())
 				_groups.push_back(Group());
 
+			if (groupNum >= _used)
+				_used = groupNum + 1;
+
 			_groups[groupNum].add_capture(cap);
 
 		}
 
+		/// <summary>
+		/// Empty the match so it can be passed to Regex::match again. The memory its groups used is kept, so a Match that's reused
+		/// for each line doesn't allocate once it has seen as many captures as a line makes
+		/// </summary>
+		void clear()
+		{
+			for (size_t i = 0; i < _used; i++)
+			{
+				_groups[i].clear();
+			}
+			_used = 0;
+		}
+
+		/// <summary>
+		/// Copy the text of every capture into the match. A match only refers to the string it was found in until this is called,
+		/// so it has to be called before that string is changed or freed if the match is kept
+		/// </summary>
+		void own()
+		{
+			for (size_t i = 0; i < _used; i++)
+			{
+				_groups[i].own();
+			}
+		}
+
 		void print_all_info(ostream &o) const
 		{
-			for (size_t i = 0; i < _groups.size(); i++)
+			for (size_t i = 0; i < _used; i++)
 			{
 				o << "           Group " << i << ": " << endl;
 				for (size_t j = 0; j < _groups[i].total_caps(); j++)
@@ -0,0 +1,154 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "capture.h"
+#include "match.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// The matches found by one call to Regex::matches. The captures of every match are kept together, in one array each for
+	/// their starts, lengths and group numbers, with the index of each match's first capture, rather than as a Match per match
+	/// with a vector for each of its groups. Filling one in only allocates when the arrays grow, and clear() keeps their memory
+	/// for the next call. Like a Match, it refers to the string that was searched rather than copying from it
+	/// </summary>
+	class MatchList
+	{
+	private:
+		const char* _str;
+		vector<size_t> _starts;
+		vector<size_t> _lengths;
+		vector<unsigned short> _groups;
+		vector<size_t> _first;		// Index of each match's first capture, then one past the last capture
+
+		size_t first(size_t match, unsigned short groupnum) const
+		{
+			size_t c = _first[match];
+			while (c < _first[match + 1] && _groups[c] != groupnum)
+			{
+				c++;
+			}
+			return c;
+		}
+
+	public:
+		MatchList()
+		{
+			_str = nullptr;
+			_first.push_back(0);
+		}
+
+		/// <summary>
+		/// Remove the matches, keeping the memory they used, and start a list of the matches in str
+		/// </summary>
+		void clear(const char* str = nullptr)
+		{
+			_str = str;
+			_starts.clear();
+			_lengths.clear();
+			_groups.clear();
+			_first.resize(1);
+		}
+
+		/// <summary>
+		/// Add a match found in the string the list was cleared with
+		/// </summary>
+		void add(const Match& m)
+		{
+			for (unsigned short g = 0; g < m.total_groups(); g++)
+			{
+				const Group& group = m.group(g);
+				for (size_t c = 0; c < group.total_caps(); c++)
+				{
+					_starts.push_back(group.capture(c).start());
+					_lengths.push_back(group.capture(c).length());
+					_groups.push_back(g);
+				}
+			}
+			_first.push_back(_starts.size());
+		}
+
+		size_t size() const
+		{
+			return _first.size() - 1;
+		}
+
+		bool empty() const
+		{
+			return size() == 0;
+		}
+
+		/// <summary>
+		/// Where a match starts
+		/// </summary>
+		size_t start(size_t match) const
+		{
+			size_t c = first(match, 0);
+			return c < _first[match + 1] ? _starts[c] : 0;
+		}
+
+		/// <summary>
+		/// How long a match is
+		/// </summary>
+		size_t length(size_t match) const
+		{
+			size_t c = first(match, 0);
+			return c < _first[match + 1] ? _lengths[c] : 0;
+		}
+
+		string value(size_t match) const
+		{
+			return get_group_value(match, 0);
+		}
+
+		/// <summary>
+		/// The number of captures a match has, over all of its groups. Captures are in order of their group, and then of when they were made
+		/// </summary>
+		size_t total_captures(size_t match) const
+		{
+			return _first[match + 1] - _first[match];
+		}
+
+		size_t capture_start(size_t match, size_t capnum) const
+		{
+			return _starts[_first[match] + capnum];
+		}
+
+		size_t capture_length(size_t match, size_t capnum) const
+		{
+			return _lengths[_first[match] + capnum];
+		}
+
+		unsigned short capture_group(size_t match, size_t capnum) const
+		{
+			return _groups[_first[match] + capnum];
+		}
+
+		/// <summary>
+		/// Returns the string value of a group of a match, the same as Match::get_group_value
+		/// </summary>
+		string get_group_value(size_t match, unsigned short groupnum) const
+		{
+			string t;
+			for (size_t c = first(match, groupnum); c < _first[match + 1] && _groups[c] == groupnum; c++)
+			{
+				t.append(_str + _starts[c], _lengths[c]);
+			}
+			return t;
+		}
+
+		/// <summary>
+		/// Fill in a Match with one of the matches, for code that takes a Match. Its captures refer to the string that was searched
+		/// </summary>
+		void get(size_t match, Match& out_match) const
+		{
+			out_match.clear();
+			for (size_t c = _first[match]; c < _first[match + 1]; c++)
+			{
+				out_match.add_group_capture(_groups[c], Capture(_str, _starts[c], _lengths[c]));
+			}
+		}
+	};
+}
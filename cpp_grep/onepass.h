@@ -0,0 +1,265 @@
+#pragma once
+#include <vector>
+#include "program.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// A DFA for programs where every byte of input leaves at most one way forward, such as ^(\d+)-(\d+) (\w+):
+	/// Since there is never more than one live thread, each transition can carry the capture slots it sets and a match
+	/// is a single forward scan with no backtracking and no per thread copies. Only anchored searches are supported.
+	/// </summary>
+	class OnePass
+	{
+	private:
+		// Capture slots are tracked as bits of a mask, which limits how many groups a one-pass program can have
+		static const size_t MAX_SLOTS = 32;
+
+		// Upper bound on the size of the transition table
+		static const size_t MAX_TABLE_BYTES = 1024 * 1024;
+
+		/// <summary>
+		/// What to do from a node on a byte, or when the input ends there
+		/// </summary>
+		struct Action
+		{
+			int next;				// The node after the byte is consumed, or -1 if there is no way forward
+			unsigned int saves;		// Capture slots set to the current position on the way
+			unsigned int conds;		// Assertions that have to hold at the current position, one bit per Inst::Op from BEGIN_LINE
+			bool match_wins;		// Stopping here has priority over this transition (a lazy quantifier, or the end of an alternation branch)
+
+			Action()
+			{
+				next = -1;
+				saves = 0;
+				conds = 0;
+				match_wins = false;
+			}
+		};
+
+		/// <summary>
+		/// A pending instruction while following the empty transitions out of a node
+		/// </summary>
+		struct Frame
+		{
+			int pc;
+			unsigned int saves;
+			unsigned int conds;
+
+			Frame(int p = 0, unsigned int s = 0, unsigned int c = 0)
+			{
+				pc = p;
+				saves = s;
+				conds = c;
+			}
+		};
+
+		const Program* _prog;
+		size_t _nslots;
+		unsigned short _classes[256];
+		size_t _stride;
+
+		vector<Action> _table;		// One row per node, one column per byte class
+		vector<Action> _matches;	// How each node reaches MATCH without consuming anything, if it can (next is 0 when it can)
+		vector<size_t> _caps;
+
+		OnePass(const Program* prog)
+		{
+			_prog = prog;
+			_nslots = prog->num_slots();
+			_stride = prog->byte_classes(_classes, false);
+			_caps = vector<size_t>(_nslots, NO_POS);
+		}
+
+		static unsigned int cond_bit(enum Inst::Op op)
+		{
+			return 1u << (op - Inst::BEGIN_LINE);
+		}
+
+		bool conds_hold(unsigned int conds, const char* str, size_t strSize, size_t pos) const
+		{
+			for (int op = Inst::BEGIN_LINE; conds != 0; op++, conds >>= 1)
+			{
+				if ((conds & 1u) && !Program::assertion_holds(static_cast<enum Inst::Op>(op), str, strSize, pos))
+					return false;
+			}
+			return true;
+		}
+
+		static void apply(unsigned int saves, size_t* caps, size_t pos)
+		{
+			for (size_t slot = 0; saves != 0; slot++, saves >>= 1)
+			{
+				if (saves & 1u)
+					caps[slot] = pos;
+			}
+		}
+
+		/// <summary>
+		/// Fill in the row for one node by following its empty transitions in priority order
+		/// </summary>
+		/// <returns>False if the program turns out not to be one-pass</returns>
+		bool build_node(int node, int start_pc, vector<int>& node_of, vector<int>& node_pcs, vector<unsigned int>& seen)
+		{
+			vector<Frame> stack(1, Frame(start_pc));
+			bool matched = false;
+
+			while (!stack.empty())
+			{
+				Frame f = stack.back();
+				stack.pop_back();
+
+				// Reaching an instruction twice means two paths lead to the same place, so input can't decide between them
+				if (seen[f.pc] == static_cast<unsigned int>(node) + 1)
+					return false;
+				seen[f.pc] = static_cast<unsigned int>(node) + 1;
+
+				const Inst& in = _prog->insts[f.pc];
+				switch (in.op)
+				{
+				case Inst::MATCH:
+					if (matched)
+						return false;
+
+					matched = true;
+					_matches[node].next = 0;
+					_matches[node].saves = f.saves;
+					_matches[node].conds = f.conds;
+					break;
+
+				case Inst::JMP:
+					stack.push_back(Frame(in.out, f.saves, f.conds));
+					break;
+
+				case Inst::SPLIT:
+					stack.push_back(Frame(in.arg, f.saves, f.conds));
+					stack.push_back(Frame(in.out, f.saves, f.conds));
+					break;
+
+				case Inst::SAVE:
+					stack.push_back(Frame(in.out, f.saves | (1u << in.arg), f.conds));
+					break;
+
+				case Inst::CHAR:
+				case Inst::RANGE:
+				case Inst::CLASS:
+				case Inst::ANY:
+				{
+					if (node_of[in.out] < 0)
+					{
+						node_of[in.out] = static_cast<int>(node_pcs.size());
+						node_pcs.push_back(in.out);
+						if (node_pcs.size() * _stride * sizeof(Action) > MAX_TABLE_BYTES)
+							return false;
+
+						_table.resize(node_pcs.size() * _stride);
+						_matches.resize(node_pcs.size());
+					}
+
+					for (unsigned int c = 0; c < 256; c++)
+					{
+						if (!_prog->accepts(in, static_cast<unsigned char>(c)))
+							continue;
+
+						Action& a = _table[node * _stride + _classes[c]];
+						if (a.next == node_of[in.out] && a.saves == f.saves && a.conds == f.conds)
+							continue;	// Already filled in from another byte of the same class
+
+						if (a.next >= 0)
+							return false;
+
+						a.next = node_of[in.out];
+						a.saves = f.saves;
+						a.conds = f.conds;
+						a.match_wins = matched;
+					}
+					break;
+				}
+
+				default:
+					stack.push_back(Frame(in.out, f.saves, f.conds | cond_bit(in.op)));
+					break;
+				}
+			}
+
+			return true;
+		}
+
+	public:
+		/// <summary>
+		/// Build the one-pass tables for a program
+		/// </summary>
+		/// <returns>The engine, or null if the program isn't one-pass or the tables would be too large</returns>
+		static OnePass* build(const Program* prog)
+		{
+			if (prog->num_slots() > MAX_SLOTS)
+				return nullptr;
+
+			OnePass* op = new OnePass(prog);
+			vector<int> node_of(prog->insts.size(), -1);
+			vector<int> node_pcs(1, 0);
+			vector<unsigned int> seen(prog->insts.size(), 0);
+
+			node_of[0] = 0;
+			op->_table.resize(op->_stride);
+			op->_matches.resize(1);
+
+			// build_node appends newly discovered nodes, so this visits every reachable one
+			for (size_t node = 0; node < node_pcs.size(); node++)
+			{
+				if (!op->build_node(static_cast<int>(node), node_pcs[node], node_of, node_pcs, seen))
+				{
+					delete op;
+					return nullptr;
+				}
+			}
+
+			return op;
+		}
+
+		/// <summary>
+		/// Match at start_pos only, not counting 0 length matches
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The position the match has to start at</param>
+		/// <param name="slots">Receives the start and end of every capture group, or NO_POS for groups that didn't participate</param>
+		/// <returns>True if a match was found</returns>
+		bool search(const char* str, size_t strSize, size_t start_pos, vector<size_t>& slots)
+		{
+			bool matched = false;
+			size_t* caps = &_caps[0];
+			for (size_t i = 0; i < _nslots; i++)
+			{
+				caps[i] = NO_POS;
+			}
+
+			int node = 0;
+			for (size_t pos = start_pos; ; pos++)
+			{
+				const Action& m = _matches[node];
+				bool can_match = m.next == 0 && pos > start_pos && conds_hold(m.conds, str, strSize, pos);
+				if (can_match)
+				{
+					slots.assign(caps, caps + _nslots);
+					apply(m.saves, &slots[0], pos);
+					matched = true;
+				}
+
+				if (pos >= strSize)
+					break;
+
+				const Action& a = _table[node * _stride + _classes[static_cast<unsigned char>(str[pos])]];
+				if (a.next < 0 || (can_match && a.match_wins) || !conds_hold(a.conds, str, strSize, pos))
+					break;
+
+				apply(a.saves, caps, pos);
+				node = a.next;
+			}
+
+			return matched;
+		}
+	};
+}
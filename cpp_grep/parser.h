@@ -13,11 +13,20 @@ namespace rex
 	class Parser
 	{
 	private:
-		static Atom* quantify(Atom* base, unsigned int min, unsigned int max, bool greedy)
+		static Atom* quantify(Atom* base, unsigned int min, unsigned int max, bool greedy, bool possessive = false)
 		{
 			// Create a temp pointer that will become the new current.
 			Atom* t = nullptr;
 
+			// Repeating a single character from a set can scan the whole run at once. An exact count is the same greedy or lazy
+			CharSet set;
+			bool single = byte_set(base, set);
+			if (possessive)
+				return new PossessiveQuantifier(base, min, max, single ? &set : nullptr);
+
+			if ((greedy || min == max) && single)
+				return new SetQuantifier(base, set, min, max);
+
 			// We de-reference the pointer to base. When it gets passed into the constructor its
 			// value is copied to a field of the quantifier object.
 			if (greedy)
@@ -28,6 +37,43 @@ namespace rex
 			return t;
 		}
 
+		/// <summary>
+		/// Get the bytes matched by a lone atom that always consumes exactly one character
+		/// </summary>
+		/// <returns>False if the atom is anything else</returns>
+		static bool byte_set(Atom* a, CharSet& out)
+		{
+			if (a->next() != nullptr)
+				return false;
+
+			switch (a->kind())
+			{
+			case Atom::CHAR_CLASS:
+				out.add_set(static_cast<CharClass*>(a)->set());
+				return true;
+
+			case Atom::CHAR_RANGE:
+				out.add_range(static_cast<CharRange*>(a)->min(), static_cast<CharRange*>(a)->max());
+				return true;
+
+			case Atom::CHAR_LITERAL:
+			{
+				CharLiteral* lit = static_cast<CharLiteral*>(a);
+				out.add(lit->value());
+				if (!lit->case_sensitive())
+					out.add(toupper_u(lit->value()));
+				return true;
+			}
+
+			case Atom::ANY_CHAR:
+				out.add_range(0, 255);
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
 		static vector<Token> sub_seq(vector<Token> &master, size_t &i, enum Token::Type endsWith, bool allowNesting)
 		{
 			size_t startIndex = i;
@@ -65,47 +111,101 @@ namespace rex
 			return sub;
 		}
 
-		static Atom* get_special(Token tok)
+		/// <summary>
+		/// Get the bytes matched by a special sequence like \w, ignoring whether it is inverted
+		/// </summary>
+		/// <returns>False if the sequence isn't a character matcher, like \b</returns>
+		static bool special_set(unsigned char c, CharSet& out)
 		{
-			// I could use my UniquePtr and SafeVector classes here, but the only spot 
-			// an exception is throw is in the default case of the switch where the ptr would be null
-
-			bool invert = tok.value[1] >= 'A' && tok.value[1] <= 'Z';
-			Atom* special;
-			int inv_step = 1;
-
-			switch (tok.value[1])
+			switch (c)
 			{
 			case 'd':
 			case 'D':
-				special = new CharRange('0', '9');
-				break;
+				out.add_range('0', '9');
+				return true;
 
 			case 'w':
 			case 'W':
-			{
-				vector<Atom*> atoms;
-				atoms.push_back(new CharRange('a', 'z'));
-				atoms.push_back(new CharRange('A', 'Z'));
-				atoms.push_back(new CharRange('0', '9'));
-				atoms.push_back(new CharLiteral('_', true));
-				special = new OrAtom(atoms);
-				break;
-			}
+				out.add_range('a', 'z');
+				out.add_range('A', 'Z');
+				out.add_range('0', '9');
+				out.add('_');
+				return true;
 
 			case 's':
 			case 'S':
+				out.add(' ');
+				out.add('\n');
+				out.add('\r');
+				out.add('\t');
+				out.add('\f');
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		/// <summary>
+		/// Build the set of bytes matched by the tokens inside a character class, with case folding applied
+		/// </summary>
+		/// <returns>False if the class holds something that isn't a single character, like \b</returns>
+		static bool class_set(const vector<Token>& toks, bool caseSensitive, CharSet& out)
+		{
+			for (size_t i = 0; i < toks.size(); i++)
 			{
-				vector<Atom*> atoms;
-				atoms.push_back(new CharLiteral(' ', true));
-				atoms.push_back(new CharLiteral('\n', true));
-				atoms.push_back(new CharLiteral('\r', true));
-				atoms.push_back(new CharLiteral('\t', true));
-				atoms.push_back(new CharLiteral('\f', true));
-				special = new OrAtom(atoms);
-				break;
+				const Token& tok = toks[i];
+				switch (tok.type)
+				{
+				case Token::LITERAL:
+					out.add(tok.value[0]);
+					break;
+
+				case Token::CHAR_RANGE:
+					out.add_range(tok.value[0], tok.value[2]);
+					break;
+
+				case Token::SPECIAL:
+				{
+					CharSet special;
+					if (!special_set(tok.value[1], special))
+						return false;
+
+					if (tok.value[1] >= 'A' && tok.value[1] <= 'Z')
+						special.invert();
+					out.add_set(special);
+					break;
+				}
+
+				default:
+					return false;
+				}
+			}
+
+			if (!caseSensitive)
+				out.fold_case();
+			return true;
+		}
+
+		static Atom* get_special(Token tok)
+		{
+			// I could use my UniquePtr and SafeVector classes here, but the only spot 
+			// an exception is throw is in the default case of the switch where the ptr would be null
+
+			bool invert = tok.value[1] >= 'A' && tok.value[1] <= 'Z';
+			Atom* special;
+			int inv_step = 1;
+
+			CharSet set;
+			if (special_set(tok.value[1], set))
+			{
+				if (invert)
+					set.invert();
+				return new CharClass(set);
 			}
 
+			switch (tok.value[1])
+			{
 			case 'b':
 			case 'B':
 				special = new WordBoundary();
@@ -123,7 +223,7 @@ namespace rex
 				return special;
 		}
 
-		static Atom* parse_inner(vector<Token> toks, bool caseSensitive, bool in_char_class, unsigned short &gNum)
+		static Atom* parse_inner(vector<Token> toks, bool caseSensitive, bool in_char_class, unsigned short &gNum, bool captures)
 		{
 			SafeVector<Atom*> ors;	// Deletes any held pointers when it goes out of scope
 			bool lastWasOr = false;
@@ -142,46 +242,20 @@ namespace rex
 				{
 					unsigned char min = tok.value[0];
 					unsigned char max = tok.value[2];
-					next.replace(new CharRange(min, max));
 					if (!caseSensitive)
 					{
-						if (min <= 'A' && max >= 'z' || max < 'A' || min > 'z' || (max > 'Z' && min < 'a'))
-							//This range already covers both cases or has no alpha characters
-							break;
-
-						bool containsUpper = max > 'A' && min < 'Z';
-						bool containsLower = max > 'a' && min < 'z';
-						SafeVector<Atom*> parts;
-						parts.add(next.release());
-
-						if (containsUpper)
-						{
-							//Get the alpha char bounds of the character range, to lower
-							unsigned char lowerMin = min >= 'A' ? min + 32 : 'a';
-							unsigned char lowerMax = max <= 'Z' ? max + 32 : 'z';
-
-							if (lowerMin < lowerMax)
-								parts.add(new CharRange(lowerMin, lowerMax));
-						}
-						else if (containsLower)
+						// Matching either case of a range is a set lookup, built the same way as a class
+						CharSet set;
+						set.add_range(min, max);
+						set.fold_case();
+						if (set.count() != static_cast<size_t>(max - min) + 1)
 						{
-							//Get the alpha char bounds of the character range, to upper
-							unsigned char upperMin = min >= 'a' ? min - 32 : 'A';
-							unsigned char upperMax = max <= 'z' ? max - 32 : 'Z';
-
-							if (upperMin < upperMax)
-								parts.add(new CharRange(upperMin, upperMax));
-						}
-
-						if (parts.size() > 1)
-							next.replace(new OrAtom(parts.release()));
-
-						else
-						{
-							next.replace(parts.at(0));
-							parts.release();
+							next.replace(new CharClass(set));
+							break;
 						}
 					}
+
+					next.replace(new CharRange(min, max));
 					break;
 				}
 				case Token::CARRET:
@@ -203,10 +277,21 @@ namespace rex
 					if (t.empty())
 						continue;	//Ignore empty char classes
 
-					next.replace(parse_inner(t, caseSensitive, true, gNum));
+					bool inverted = tok.originalText.size() > 1 && tok.originalText[1] == '^';
+
+					CharSet set;
+					if (class_set(t, caseSensitive, set))
+					{
+						if (inverted)
+							set.invert();
+						next.replace(new CharClass(set));
+						break;
+					}
+
+					next.replace(parse_inner(t, caseSensitive, true, gNum, captures));
 
 					//Check if this is inverted
-					if (tok.originalText.size() > 1 && tok.originalText[1] == '^')
+					if (inverted)
 						next.replace(new InversionAtom(next.release(), 1));
 
 					break;
@@ -224,7 +309,13 @@ namespace rex
 					//Check if this is a non-capturing group
 					else if (tok.originalText.length() == 3 && tok.originalText[1] == '?' && tok.originalText[2] == ':')
 					{
-						next.replace(parse_inner(t, caseSensitive, false, gNum));
+						next.replace(parse_inner(t, caseSensitive, false, gNum, captures));
+					}
+
+					//Check if this is an atomic group, which is also non-capturing
+					else if (tok.originalText.length() == 3 && tok.originalText[1] == '?' && tok.originalText[2] == '>')
+					{
+						next.replace(new AtomicGroup(parse_inner(t, caseSensitive, false, gNum, captures)));
 					}
 
 					//This is a capturing group
@@ -233,7 +324,10 @@ namespace rex
 						unsigned short captureGroup = gNum;	//Store off our capture group before it gets incremented
 						gNum++;
 
-						next.replace(parse_inner(t, caseSensitive, false, gNum));
+						next.replace(parse_inner(t, caseSensitive, false, gNum, captures));
+						if (!captures)
+							break;
+
 						// Create the group start with the inner part of the group attached
 						UniquePtr<GroupStart*> start(new GroupStart(captureGroup, next.get()));
 						//Create an end group atom with a reference to the start atom, the attach the end to the start;
@@ -267,28 +361,41 @@ namespace rex
 				if (i + 1 < toks.size())
 				{
 					bool greedy = false;
+					bool possessive = false;
 					Token t2 = toks[i + 1];
 
 					switch (t2.type)
 					{
+					case Token::POSSESSIVE_Q_MARK:
+						possessive = true;
+						// fall through
 					case Token::GREEDY_Q_MARK:
 						greedy = true;
+						// fall through
 					case Token::LAZY_Q_MARK:
-						next.replace(quantify(next.release(), 0, 1, greedy));
+						next.replace(quantify(next.release(), 0, 1, greedy, possessive));
 						i++;
 						break;
 
+					case Token::POSSESSIVE_STAR:
+						possessive = true;
+						// fall through
 					case Token::GREEDY_STAR:
 						greedy = true;
+						// fall through
 					case Token::LAZY_STAR:
-						next.replace(quantify(next.release(), 0, UINT32_MAX, greedy));
+						next.replace(quantify(next.release(), 0, UINT32_MAX, greedy, possessive));
 						i++;
 						break;
 
+					case Token::POSSESSIVE_PLUS:
+						possessive = true;
+						// fall through
 					case Token::GREEDY_PLUS:
 						greedy = true;
+						// fall through
 					case Token::LAZY_PLUS:
-						next.replace(quantify(next.release(), 1, UINT32_MAX, greedy));
+						next.replace(quantify(next.release(), 1, UINT32_MAX, greedy, possessive));
 						i++;
 						break;
 
@@ -301,26 +408,34 @@ namespace rex
 						break;
 					}
 
+					case Token::POSSESSIVE_MIN_QUAN:
+						possessive = true;
+						// fall through
 					case Token::GREEDY_MIN_QUAN:
 						greedy = true;
+						// fall through
 					case Token::LAZY_MIN_QUAN:
 					{
 						unsigned int x;
 						istringstream(t2.value) >> x;	//TODO: Get a better way of parsing numbers
-						next.replace(quantify(next.release(), x, UINT32_MAX, greedy));	//TODO: Make no max a thing, and make lazy version
+						next.replace(quantify(next.release(), x, UINT32_MAX, greedy, possessive));	//TODO: Make no max a thing, and make lazy version
 						i++;
 						break;
 					}
 
+					case Token::POSSESSIVE_RANGE_QUAN:
+						possessive = true;
+						// fall through
 					case Token::GREEDY_RANGE_QUAN:
 						greedy = true;
+						// fall through
 					case Token::LAZY_RANGE_QUAN:
 					{
 						unsigned int x, y;
 						size_t com = t2.value.find(',');
 						istringstream(t2.value.substr(0, com)) >> x;	//TODO: Get a better way of parsing numbers
 						istringstream(t2.value.substr(com + 1)) >> y;	//TODO: Get a better way of parsing numbers
-						next.replace(quantify(next.release(), x, y, greedy));
+						next.replace(quantify(next.release(), x, y, greedy, possessive));
 						i++;
 						break;
 					}
@@ -363,11 +478,15 @@ namespace rex
 		}//End parse_inner
 		
 	public:
-		static Atom* parse(vector<Token> toks, bool caseSensistive, unsigned short &num_groups)
+		/// <param name="captures">Set to false to leave out every group's start and end atoms, group 0's included, for matching
+		/// without the groups. Capturing groups are then parsed like non-capturing ones, and the match is as long as try_match returns</param>
+		static Atom* parse(vector<Token> toks, bool caseSensistive, unsigned short &num_groups, bool captures = true)
 		{
 			num_groups = 1;	// The starting group number is one, so that we can use group 0 for the whole match.
 							// This var gets reused as an out var
-			Atom* inner = parse_inner(toks, caseSensistive, false, num_groups);
+			Atom* inner = parse_inner(toks, caseSensistive, false, num_groups, captures);
+			if (!captures)
+				return inner;
 
 			GroupStart* start = new GroupStart(0, inner);
 			GroupEnd* end = new GroupEnd(0);
@@ -377,6 +496,43 @@ namespace rex
 			return start;
 		}
 
+		/// <summary>
+		/// Build the atoms for a list of fixed strings directly, without lexing them, so every character matches itself
+		/// </summary>
+		/// <param name="strings">The strings to match. A match is an occurrence of any of them</param>
+		/// <param name="num_groups">Receives the number of groups, which is always just group 0</param>
+		static Atom* literal(const vector<string>& strings, bool caseSensitive, unsigned short &num_groups)
+		{
+			num_groups = 1;
+
+			SafeVector<Atom*> branches;
+			for (size_t i = 0; i < strings.size(); i++)
+			{
+				// Built back to front so each literal is handed its next atom instead of being appended to the end of the chain
+				Atom* chain = nullptr;
+				for (size_t j = strings[i].size(); j-- > 0;)
+				{
+					chain = new CharLiteral(strings[i][j], caseSensitive, chain);
+				}
+
+				if (chain != nullptr)
+					branches.add(chain);
+			}
+
+			if (branches.size() == 0)
+				throw RegexException("Regex pattern cannot be empty");
+
+			Atom* inner = nullptr;
+			if (branches.size() == 1)
+				inner = branches.release()[0];
+			else
+				inner = new OrAtom(branches.release());
+
+			GroupStart* start = new GroupStart(0, inner);
+			start->append(new GroupEnd(0));
+			return start;
+		}
+
 };
 }
 
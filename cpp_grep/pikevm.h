@@ -0,0 +1,248 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "program.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Runs a compiled Program as a Thompson NFA simulation (Pike VM). Every thread carries its own capture slots and
+	/// each instruction is visited at most once per input position, so a search costs O(program size * input size)
+	/// regardless of the pattern. Follows the same leftmost-first preference order as the backtracking atoms.
+	/// </summary>
+	class PikeVM
+	{
+	private:
+		/// <summary>
+		/// A set of threads keyed by instruction, kept in priority order. Uses a sparse set so clearing is O(1)
+		/// </summary>
+		class ThreadList
+		{
+		private:
+			vector<int> _sparse;
+			vector<int> _dense;
+			vector<size_t> _caps;
+			size_t _nslots;
+			size_t _count;
+
+		public:
+			void init(size_t ninsts, size_t nslots)
+			{
+				_sparse = vector<int>(ninsts, 0);
+				_dense = vector<int>(ninsts, 0);
+				_caps = vector<size_t>(ninsts * nslots + 1, NO_POS);
+				_nslots = nslots;
+				_count = 0;
+			}
+
+			bool contains(int pc) const
+			{
+				size_t i = static_cast<size_t>(_sparse[pc]);
+				return i < _count && _dense[i] == pc;
+			}
+
+			/// <summary>
+			/// Add pc to the set and return its capture slots
+			/// </summary>
+			size_t* insert(int pc)
+			{
+				_sparse[pc] = static_cast<int>(_count);
+				_dense[_count] = pc;
+				return &_caps[_count++ * _nslots];
+			}
+
+			size_t size() const
+			{
+				return _count;
+			}
+
+			int pc_at(size_t i) const
+			{
+				return _dense[i];
+			}
+
+			size_t* caps_at(size_t i)
+			{
+				return &_caps[i * _nslots];
+			}
+
+			void clear()
+			{
+				_count = 0;
+			}
+
+			void swap(ThreadList& other)
+			{
+				_sparse.swap(other._sparse);
+				_dense.swap(other._dense);
+				_caps.swap(other._caps);
+				std::swap(_nslots, other._nslots);
+				std::swap(_count, other._count);
+			}
+		};
+
+		/// <summary>
+		/// A pending instruction to follow, or a capture slot to restore once a branch has been explored
+		/// </summary>
+		struct Frame
+		{
+			int pc;
+			int slot;
+			size_t pos;
+
+			Frame(int p = 0, int s = -1, size_t v = 0)
+			{
+				pc = p;
+				slot = s;
+				pos = v;
+			}
+		};
+
+		const Program* _prog;
+		size_t _nslots;
+		ThreadList _clist;
+		ThreadList _nlist;
+		vector<Frame> _stack;
+		vector<size_t> _caps;
+
+		/// <summary>
+		/// Follow every empty transition from pc at pos, adding the threads that consume input (or match) to q in priority order
+		/// </summary>
+		void add_thread(ThreadList& q, int pc, const char* str, size_t strSize, size_t pos, size_t* caps)
+		{
+			_stack.clear();
+			_stack.push_back(Frame(pc));
+
+			while (!_stack.empty())
+			{
+				Frame f = _stack.back();
+				_stack.pop_back();
+
+				if (f.slot >= 0)
+				{
+					caps[f.slot] = f.pos;
+					continue;
+				}
+
+				pc = f.pc;
+				while (!q.contains(pc))
+				{
+					const Inst& in = _prog->insts[pc];
+
+					// A thread that reaches the end without consuming anything is a 0 length match, which doesn't count
+					if (in.op == Inst::MATCH && caps[0] == pos)
+						break;
+
+					size_t* tcaps = q.insert(pc);
+					bool follow = false;
+
+					switch (in.op)
+					{
+					case Inst::JMP:
+						follow = true;
+						break;
+
+					case Inst::SPLIT:
+						_stack.push_back(Frame(in.arg));
+						follow = true;
+						break;
+
+					case Inst::SAVE:
+						_stack.push_back(Frame(0, in.arg, caps[in.arg]));
+						caps[in.arg] = pos;
+						follow = true;
+						break;
+
+					case Inst::MATCH:
+					case Inst::CHAR:
+					case Inst::RANGE:
+					case Inst::CLASS:
+					case Inst::ANY:
+						for (size_t i = 0; i < _nslots; i++)
+						{
+							tcaps[i] = caps[i];
+						}
+						break;
+
+					default:
+						follow = Program::assertion_holds(in.op, str, strSize, pos);
+						break;
+					}
+
+					if (!follow)
+						break;
+
+					pc = in.out;
+				}
+			}
+		}
+
+	public:
+		PikeVM(const Program* prog)
+		{
+			_prog = prog;
+			_nslots = prog->num_slots();
+			_clist.init(prog->insts.size(), _nslots);
+			_nlist.init(prog->insts.size(), _nslots);
+			_caps = vector<size_t>(_nslots, NO_POS);
+		}
+
+		/// <summary>
+		/// Search for the leftmost match starting at or after start_pos
+		/// </summary>
+		/// <param name="str">The string to search</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The first position a match may start at</param>
+		/// <param name="anchored">Only accept a match starting exactly at start_pos</param>
+		/// <param name="slots">Receives the start and end of every capture group, or NO_POS for groups that didn't participate</param>
+		/// <returns>True if a match was found</returns>
+		bool search(const char* str, size_t strSize, size_t start_pos, bool anchored, vector<size_t>& slots)
+		{
+			bool matched = false;
+			slots.assign(_nslots, NO_POS);
+			_clist.clear();
+
+			for (size_t pos = start_pos; pos <= strSize; pos++)
+			{
+				// New threads have the lowest priority, so they start after every thread already running
+				if (!matched && (!anchored || pos == start_pos))
+				{
+					for (size_t i = 0; i < _nslots; i++)
+					{
+						_caps[i] = NO_POS;
+					}
+
+					add_thread(_clist, 0, str, strSize, pos, &_caps[0]);
+				}
+
+				if (_clist.size() == 0 && (matched || anchored))
+					break;
+
+				_nlist.clear();
+				for (size_t i = 0; i < _clist.size(); i++)
+				{
+					const Inst& in = _prog->insts[_clist.pc_at(i)];
+					size_t* tcaps = _clist.caps_at(i);
+
+					if (in.op == Inst::MATCH)
+					{
+						slots.assign(tcaps, tcaps + _nslots);
+						matched = true;
+
+						// Every thread after this one has a lower priority, so drop them
+						break;
+					}
+
+					if (pos < strSize && _prog->accepts(in, static_cast<unsigned char>(str[pos])))
+						add_thread(_nlist, in.out, str, strSize, pos + 1, tcaps);
+				}
+
+				_clist.swap(_nlist);
+			}
+
+			return matched;
+		}
+	};
+}
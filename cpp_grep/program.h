@@ -0,0 +1,265 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include "charset.h"
+#include "utils.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Marks a capture slot that has not been set
+	/// </summary>
+	const size_t NO_POS = static_cast<size_t>(-1);
+
+	/// <summary>
+	/// A single instruction of a compiled regex program
+	/// </summary>
+	class Inst
+	{
+	public:
+		enum Op
+		{
+			MATCH,				// arg is the pattern's index, in a pattern set
+			CHAR,				// lo
+			RANGE,				// lo - hi
+			CLASS,				// arg is an index into the program's classes
+			ANY,
+			SPLIT,				// Try out first, then arg
+			JMP,
+			SAVE,				// arg is the capture slot to record the position in
+			BEGIN_LINE,
+			END_LINE,
+			BEGIN_STRING,
+			END_STRING,
+			WORD_BOUNDARY,
+			NOT_WORD_BOUNDARY
+		};
+
+		enum Op op;
+		int out;
+		int arg;
+		unsigned char lo;
+		unsigned char hi;
+
+		Inst(enum Op o = MATCH, int next = -1, int a = 0, unsigned char l = 0, unsigned char h = 0)
+		{
+			op = o;
+			out = next;
+			arg = a;
+			lo = l;
+			hi = h;
+		}
+
+		bool consumes() const
+		{
+			return op >= CHAR && op <= ANY;
+		}
+
+		bool is_assertion() const
+		{
+			return op >= BEGIN_LINE;
+		}
+	};
+
+	/// <summary>
+	/// A regex lowered into a flat array of instructions. Execution starts at instruction 0 and each instruction names its successors explicitly
+	/// </summary>
+	class Program
+	{
+	public:
+		vector<Inst> insts;
+		vector<CharSet> classes;
+		unsigned short num_groups;
+		bool repeated_groups;	// A capture group sits inside a quantifier that can match more than once
+		bool reversed;			// Matches from the end of the text back towards the start. Assertions still mean what they say about the text
+		bool pattern_set;		// Holds several patterns side by side. Each one's MATCH has the pattern's index as its arg
+
+		Program(unsigned short groups = 1)
+		{
+			num_groups = groups;
+			repeated_groups = false;
+			reversed = false;
+			pattern_set = false;
+		}
+
+		size_t num_slots() const
+		{
+			return static_cast<size_t>(num_groups) * 2;
+		}
+
+		/// <summary>
+		/// Check if a consuming instruction accepts the byte c
+		/// </summary>
+		bool accepts(const Inst& in, unsigned char c) const
+		{
+			switch (in.op)
+			{
+			case Inst::CHAR:
+				return c == in.lo;
+			case Inst::RANGE:
+				return in.lo <= c && c <= in.hi;
+			case Inst::CLASS:
+				return classes[in.arg].contains(c);
+			case Inst::ANY:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		/// <summary>
+		/// Split the byte values into classes that no instruction can tell apart, so automata only need one column per class
+		/// </summary>
+		/// <param name="out">Receives the class of each byte value</param>
+		/// <param name="split_assertions">Also separate the bytes that assertions look at (\n, \r and word characters)</param>
+		/// <returns>The number of classes</returns>
+		size_t byte_classes(unsigned short out[256], bool split_assertions) const
+		{
+			bool split[257] = { false };
+
+			for (size_t i = 0; i < insts.size(); i++)
+			{
+				const Inst& in = insts[i];
+				switch (in.op)
+				{
+				case Inst::CHAR:
+					split[in.lo] = split[in.lo + 1] = true;
+					break;
+				case Inst::RANGE:
+					split[in.lo] = split[in.hi + 1] = true;
+					break;
+				case Inst::CLASS:
+					for (unsigned int c = 1; c < 256; c++)
+					{
+						if (classes_differ(in.arg, c))
+							split[c] = true;
+					}
+					break;
+				default:
+					break;
+				}
+			}
+
+			if (split_assertions)
+			{
+				split['\n'] = split['\n' + 1] = true;
+				split['\r'] = split['\r' + 1] = true;
+				for (unsigned int c = 1; c < 256; c++)
+				{
+					if (isword_u(static_cast<unsigned char>(c)) != isword_u(static_cast<unsigned char>(c - 1)))
+						split[c] = true;
+				}
+			}
+
+			unsigned short cls = 0;
+			for (unsigned int c = 0; c < 256; c++)
+			{
+				if (c > 0 && split[c])
+					cls++;
+
+				out[c] = cls;
+			}
+
+			return static_cast<size_t>(cls) + 1;
+		}
+
+		bool has_assertions() const
+		{
+			for (size_t i = 0; i < insts.size(); i++)
+			{
+				if (insts[i].is_assertion())
+					return true;
+			}
+			return false;
+		}
+
+		/// <summary>
+		/// Check if control can get back to an instruction without consuming anything, such as (a*)*
+		/// Engines that explore one path at a time would loop forever on those
+		/// </summary>
+		bool has_empty_loops() const
+		{
+			// Depth first search over the empty transitions. 1 = on the current path, 2 = finished
+			vector<unsigned char> state(insts.size(), 0);
+			vector<pair<int, int> > stack;
+
+			for (size_t root = 0; root < insts.size(); root++)
+			{
+				if (state[root] != 0)
+					continue;
+
+				stack.push_back(make_pair(static_cast<int>(root), 0));
+				state[root] = 1;
+				while (!stack.empty())
+				{
+					int pc = stack.back().first;
+					int edge = stack.back().second++;
+					int next = empty_successor(pc, edge);
+
+					if (next < 0)
+					{
+						state[pc] = 2;
+						stack.pop_back();
+					}
+					else if (state[next] == 1)
+						return true;
+					else if (state[next] == 0)
+					{
+						state[next] = 1;
+						stack.push_back(make_pair(next, 0));
+					}
+				}
+			}
+
+			return false;
+		}
+
+		/// <summary>
+		/// Check if a zero width assertion holds at pos
+		/// </summary>
+		static bool assertion_holds(enum Inst::Op op, const char* str, size_t strSize, size_t pos)
+		{
+			switch (op)
+			{
+			case Inst::BEGIN_LINE:
+				return pos == 0 || str[pos - 1] == '\n';
+			case Inst::END_LINE:
+				return pos >= strSize || str[pos] == '\n' || str[pos] == '\r';
+			case Inst::BEGIN_STRING:
+				return pos == 0;
+			case Inst::END_STRING:
+				return pos >= strSize;
+			case Inst::WORD_BOUNDARY:
+			case Inst::NOT_WORD_BOUNDARY:
+			{
+				bool before = pos > 0 && isword_u(str[pos - 1]);
+				bool after = pos < strSize && isword_u(str[pos]);
+				return (before != after) == (op == Inst::WORD_BOUNDARY);
+			}
+			default:
+				return false;
+			}
+		}
+
+	private:
+		/// <summary>
+		/// The nth instruction reachable from pc without consuming input, or -1 if there are no more
+		/// </summary>
+		int empty_successor(int pc, int n) const
+		{
+			const Inst& in = insts[pc];
+			if (in.consumes() || in.op == Inst::MATCH || n > 1)
+				return -1;
+			if (n == 1)
+				return in.op == Inst::SPLIT ? in.arg : -1;
+			return in.out;
+		}
+
+		bool classes_differ(int cls, unsigned int c) const
+		{
+			return classes[cls].contains(static_cast<unsigned char>(c)) != classes[cls].contains(static_cast<unsigned char>(c - 1));
+		}
+	};
+}
@@ -1,10 +1,23 @@
 #pragma once
 #include <string>
+#include <algorithm>
 #include "MatchState.h"
+#include "matchlist.h"
 #include "atom.h"
 #include "utils.h"
 #include "lexer.h"
 #include "parser.h"
+#include "program.h"
+#include "compiler.h"
+#include "pikevm.h"
+#include "lazydfa.h"
+#include "onepass.h"
+#include "bitparallel.h"
+#include "backtrack.h"
+#include "jit.h"
+#include "literal.h"
+#include "teddy.h"
+#include "analysis.h"
 
 namespace rex
 {
@@ -12,32 +25,570 @@ namespace rex
 
 	class Regex
 	{
+	public:
+		/// <summary>
+		/// Options that can be combined and passed to the constructor
+		/// </summary>
+		enum Flags
+		{
+			NONE = 0,
+			LINEAR = 1,		// Match with the Pike VM, which runs in linear time for any pattern, instead of the backtracking atoms
+			BYTECODE = 2,	// Match with the bytecode interpreter instead of the atoms, when the pattern supports it
+			JIT = 4,		// Match with native code generated for the pattern, when the platform and pattern support it
+			LITERAL = 8		// The pattern is a list of fixed strings, one per line, instead of a regex
+		};
+
 	private:
 		string _pattern_str;
 		Atom* _pattern;
+		Atom* _bare;				// _pattern without any group atoms, for the atoms to match with when the groups aren't wanted
 		unsigned int _minLen;
+		unsigned int _maxLen;		// UINT32_MAX when matches can be any length
 		unsigned short _numGroups;
 		MatchState _state;
+		Match _scratch;				// Reused by matches() for each match it adds to a MatchList
+		unsigned int _flags;
+		Program* _prog;
+		PikeVM* _pike;
+		LazyDFA* _dfa;
+		OnePass* _onepass;
+		BitParallel* _bitparallel;
+		Backtracker* _backtrack;
+		Jit* _jit;
+		PikeVM* _span_vm;			// Finds where matches are when the groups are filled in afterwards, by _fill or the atoms. That's on the default
+									// engine, or when the bytecode interpreter can't run on the text
+		Backtracker* _fill;			// Fills in the groups of a match _span_vm found on the default engine, the same way the BYTECODE engine would
+		vector<size_t> _slots;
+		LiteralSearcher _prefix;	// Every match starts with this
+		LiteralSearcher _required;	// Every match contains this. Only set when it says more than the prefix
+		Teddy* _starts;				// Every match starts with one of these. For a LITERAL pattern they're the whole strings
+		LiteralSearcher _suffix;	// Every match ends with this. Only set when there's nothing better to search for
+		const char* _suffix_text;	// The text and start of the last search that scanned back from _suffix, to tell when the next one is
+		size_t _suffix_size;		// a later search of the same text
+		size_t _suffix_from;
+		Program* _rev_prog;			// The pattern compiled backwards
+		LazyDFA* _rev_dfa;			// Runs _rev_prog back from where a match ends, or from the last _suffix, to find where it starts
+		bool _dfa_ends;				// The forward DFA ends matches where the other engines do. Loops that can match nothing may make them differ
+		vector<LiteralSearcher> _literals;	// The strings of a LITERAL pattern, which are searched for directly
+		RunScanner* _skip;			// Runs over bytes no match can start with, when there's no literal to search for
+		bool _begin_line;			// Every match starts at the beginning of a line
+		bool _begin_string;			// Every match starts at the beginning of the input
+		bool _end_line;				// Every match ends at the end of a line or the end of the input
+
+		// Regex owns its compiled pattern, so it can't be copied
+		Regex(const Regex&);
+		Regex& operator=(const Regex&);
+
+		/// <summary>
+		/// Split a LITERAL pattern into its strings
+		/// </summary>
+		static vector<string> split_lines(const string& pattern)
+		{
+			vector<string> lines;
+			size_t start = 0;
+			for (size_t nl = pattern.find('\n'); nl != string::npos; nl = pattern.find('\n', start))
+			{
+				lines.push_back(pattern.substr(start, nl - start));
+				start = nl + 1;
+			}
+
+			lines.push_back(pattern.substr(start));
+			return lines;
+		}
+
+		/// <summary>
+		/// Find the leftmost occurrence of any of the LITERAL strings. At a tie the string listed first wins, like an alternation
+		/// </summary>
+		/// <param name="len">Receives the length of the string found</param>
+		/// <returns>The position of the occurrence, or NO_POS</returns>
+		size_t find_literal(const char* str, size_t strSize, size_t start_pos, size_t& len) const
+		{
+			if (_starts != nullptr)
+			{
+				size_t which;
+				size_t pos = _starts->find(str, strSize, start_pos, which);
+				if (pos != NO_POS)
+					len = _starts->literal(which).size();
+				return pos;
+			}
+
+			size_t best = NO_POS;
+			for (size_t i = 0; i < _literals.size(); i++)
+			{
+				// Only an occurrence that starts before the best one so far can replace it
+				size_t n = _literals[i].needle().size();
+				size_t limit = best == NO_POS ? strSize : min(strSize, best + n - 1);
+
+				size_t pos = _literals[i].find(str, limit, start_pos);
+				if (pos != NO_POS)
+				{
+					best = pos;
+					len = n;
+				}
+			}
+
+			return best;
+		}
+
+		/// <summary>
+		/// Quick check for text that can't contain a match, because a literal every match needs is missing
+		/// </summary>
+		bool may_match(const char* str, size_t strSize, size_t start_pos) const
+		{
+			return _required.empty() || _required.find(str, strSize, start_pos) != NO_POS;
+		}
+
+		/// <summary>
+		/// Find where the leftmost match at or after from starts, for patterns like .*connection refused that have nothing to
+		/// search for at the start but end in a literal. Every match ends with an occurrence of the literal, so none can end after
+		/// the last one, and one backwards scan from there passes every position a match starts at.
+		/// The scan covers the rest of the text though, so a series of searches like matches() makes would take quadratic time.
+		/// Only the first search of a text uses it, and the later ones give up for the other engines to search forward instead
+		/// </summary>
+		LazyDFA::Result suffix_start(const char* str, size_t strSize, size_t from, size_t& start)
+		{
+			bool later = str == _suffix_text && strSize == _suffix_size && from > _suffix_from;
+			_suffix_text = str;
+			_suffix_size = strSize;
+			_suffix_from = from;
+			if (later)
+				return LazyDFA::GAVE_UP;
+
+			size_t last = _suffix.rfind(str, strSize, from);
+			if (last == NO_POS)
+				return LazyDFA::NOT_FOUND;
+
+			return _rev_dfa->search_reverse(str, strSize, last + _suffix.needle().size(), from, false, start);
+		}
+
+		/// <summary>
+		/// Find where the leftmost match at or after from starts and ends, using only the DFAs. The forward DFA finds where
+		/// the match ends, then the reversed one runs back from there to the furthest start, which is where the match begins.
+		/// When the forward DFA can't be trusted with the ends, a literal suffix can still give the start
+		/// </summary>
+		/// <param name="end">Receives the end, or NO_POS if only the start could be found</param>
+		/// <returns>FOUND with the bounds, NOT_FOUND, or GAVE_UP if the DFAs ran out of memory or can't be used on this pattern</returns>
+		LazyDFA::Result find_bounds(const char* str, size_t strSize, size_t from, size_t& start, size_t& end)
+		{
+			end = NO_POS;
+			if (!_suffix.empty())
+				return suffix_start(str, strSize, from, start);
+
+			if (!_dfa_ends)
+				return LazyDFA::GAVE_UP;
+
+			LazyDFA::Result r = _dfa->search(str, strSize, from, false, false, end);
+			if (r != LazyDFA::FOUND)
+				return r;
+
+			return _rev_dfa->search_reverse(str, strSize, end, from, true, start);
+		}
+
+		/// <summary>
+		/// Find the first position at or after pos where a match could start
+		/// </summary>
+		/// <returns>The position, or NO_POS if no match can start there or later</returns>
+		size_t next_start(const char* str, size_t strSize, size_t pos) const
+		{
+			// Each check can only move pos forward, so they're repeated until none of them moves it
+			for (size_t last = NO_POS; pos != last && pos != NO_POS && pos < strSize;)
+			{
+				last = pos;
+				if (_begin_string && pos > 0)
+					return NO_POS;
+
+				if (_begin_line && pos > 0 && str[pos - 1] != '\n')
+				{
+					const char* nl = static_cast<const char*>(memchr(str + pos, '\n', strSize - pos));
+					if (nl == nullptr)
+						return NO_POS;
+					pos = nl - str + 1;
+				}
+
+				// A match has to reach the first line end after it starts, and can only be so long
+				if (_end_line && _maxLen != UINT32_MAX)
+				{
+					size_t end = pos;
+					while (end < strSize && str[end] != '\n' && str[end] != '\r')
+						end++;
+					if (end - pos > _maxLen)
+						pos = end - _maxLen;
+				}
+
+				if (_starts != nullptr)
+				{
+					size_t which;
+					pos = _starts->find(str, strSize, pos, which);
+				}
+				else if (!_prefix.empty())
+					pos = _prefix.find(str, strSize, pos);
+				else if (_skip != nullptr)
+				{
+					// At a line start only the one byte matters, the next line is found above
+					pos += _skip->run(str + pos, _begin_line ? 1 : strSize - pos);
+				}
+			}
+
+			if (pos == NO_POS || pos + _minLen >= strSize)
+				return NO_POS;
+			return pos;
+		}
+
+		/// <summary>
+		/// Copy the capture slots filled in by a compiled engine into a Match
+		/// </summary>
+		void commit_slots(const char* str, Match& out_match)
+		{
+			for (unsigned short i = 0; i < _numGroups; i++)
+			{
+				size_t start = _slots[i * 2];
+				size_t end = _slots[i * 2 + 1];
+				if (start != NO_POS && end != NO_POS && start <= end)
+					out_match.add_group_capture(i, Capture(str, start, end - start));
+			}
+		}
+
+		/// <summary>
+		/// Match the atoms from start, held to ending at end, so they fill in the groups of a match the compiled engines found.
+		/// The atoms record every capture of a repeated group, which the VM doesn't, but they don't always find the match it does
+		/// </summary>
+		/// <returns>False if the atoms can't find that match, in which case _state is reset so none of their captures are left behind</returns>
+		bool atoms_between(const char* str, size_t strSize, size_t start, size_t end)
+		{
+			MatchState::EndRule outer = _state.end_at(end);
+			int r = _pattern->try_match(str, strSize, start, _state);
+
+			// A failed try can leave captures behind, which the next match would commit with its own
+			if (r <= 0)
+				_state.reset();
+
+			_state.restore_end(outer);
+			return r > 0;
+		}
+
+		/// <summary>
+		/// Fill in the groups of a match the compiled engines found from start to end. The bytecode interpreter records the
+		/// groups the way the BYTECODE engine would, unless the match is too long for its visited set, which leaves it to the atoms
+		/// </summary>
+		/// <returns>True with the captures in _state. False leaves _state empty, for the VM to fill in the groups instead</returns>
+		bool fill_between(const char* str, size_t strSize, size_t start, size_t end)
+		{
+			Backtracker* bt = _backtrack != nullptr ? _backtrack : _fill;
+			if (bt != nullptr && bt->supports(end, start))
+				return bt->match_between(str, strSize, start, end, _state);
+
+			return atoms_between(str, strSize, start, end);
+		}
+
+		/// <summary>
+		/// Check if the matches in a text are found before their groups are filled in, rather than by an engine that fills in
+		/// the groups as it goes
+		/// </summary>
+		bool span_first(size_t strSize, size_t pos) const
+		{
+			return _span_vm != nullptr && (_backtrack == nullptr || !_backtrack->supports(strSize, pos));
+		}
+
+		/// <summary>
+		/// Where run_here left the match it found
+		/// </summary>
+		enum Found
+		{
+			NO_MATCH,
+			IN_SLOTS,	// The groups are in _slots
+			IN_STATE,	// The groups are in _state, which has to be committed or reset
+			AT_END		// Only the end of the match was found, in end. Nothing was kept in _state
+		};
+
+		/// <summary>
+		/// Try to match at pos with the fastest engine that can, for a caller that tries increasing positions on the same text
+		/// and has already told the backtracker it is a new text
+		/// </summary>
+		/// <param name="groups">Find the other groups, not just group 0. When false, the match may be left AT_END</param>
+		/// <param name="end">Where the match ends, for AT_END</param>
+		Found run_here(const char* str, size_t strSize, size_t pos, bool groups, size_t& end)
+		{
+			// The native code can't stop partway, so it's left out while the search has limits
+			if (_jit != nullptr && !_state.limited())
+			{
+				Jit::Result r = _jit->match_at(str, strSize, pos, end);
+				if (r == Jit::NOT_FOUND)
+					return NO_MATCH;
+
+				if (r == Jit::FOUND && !groups)
+					return AT_END;
+
+				if (r == Jit::FOUND && _numGroups == 1)
+				{
+					_state.startNewCapture(0, pos);
+					_state.end_capture(0, end);
+					return IN_STATE;
+				}
+			}
+
+			if (_onepass != nullptr)
+				return _onepass->search(str, strSize, pos, _slots) ? IN_SLOTS : NO_MATCH;
+
+			if (_pike != nullptr)
+				return _pike->search(str, strSize, pos, true, _slots) ? IN_SLOTS : NO_MATCH;
+
+			if (_backtrack != nullptr && _backtrack->supports(strSize, pos))
+				return _backtrack->match_at(str, strSize, pos, _state, groups) ? IN_STATE : NO_MATCH;
+
+			// The program decides the match, so it's the same one the DFAs find, and its groups are filled in after
+			if (_span_vm != nullptr)
+			{
+				if (!_span_vm->search(str, strSize, pos, true, _slots))
+					return NO_MATCH;
+
+				end = _slots[1];
+				if (!groups)
+					return AT_END;
+
+				return _numGroups > 1 && fill_between(str, strSize, pos, end) ? IN_STATE : IN_SLOTS;
+			}
+
+			// 0 length matches don't count, so like the compiled engines the atoms keep looking for a longer one
+			MatchState::EndRule outer = _state.end_not_at(pos);
+
+			// Without the group atoms there's nothing to record, and the length matched gives the end
+			if (!groups && _bare != nullptr)
+			{
+				int r = _bare->try_match(str, strSize, pos, _state);
+				_state.restore_end(outer);
+				if (r > 0)
+				{
+					end = pos + r;
+					return AT_END;
+				}
+				return NO_MATCH;
+			}
+
+			int r = _pattern->try_match(str, strSize, pos, _state);
+			_state.restore_end(outer);
+			return r > 0 ? IN_STATE : NO_MATCH;
+		}
+
+		/// <summary>
+		/// matchAt, for a caller that tries increasing positions on the same text and has already told the backtracker it is a new text
+		/// </summary>
+		bool match_here(const char* str, size_t strSize, Match& out_match, size_t pos)
+		{
+			size_t end;
+			switch (run_here(str, strSize, pos, true, end))
+			{
+			case IN_SLOTS:
+				commit_slots(str, out_match);
+				return true;
+
+			case IN_STATE:
+				_state.commit(out_match, str, strSize);	// Commit will reset the state object
+				return true;
+
+			default:
+				return false;
+			}
+		}
+
+		/// <summary>
+		/// match_here for just the bounds of the match
+		/// </summary>
+		bool span_here(const char* str, size_t strSize, size_t pos, size_t& match_start, size_t& match_end)
+		{
+			size_t end;
+			switch (run_here(str, strSize, pos, false, end))
+			{
+			case IN_SLOTS:
+				match_start = _slots[0];
+				match_end = _slots[1];
+				return true;
+
+			case AT_END:
+				match_start = pos;
+				match_end = end;
+				return true;
+
+			case IN_STATE:
+				return _state.commit_span(0, strSize, match_start, match_end);
+
+			default:
+				return false;
+			}
+		}
 
 	public:
 		Regex() 
 		{
 			_pattern_str = "";
 			_pattern = nullptr;
+			_bare = nullptr;
 			_numGroups = 1;
+			_flags = NONE;
+			_prog = nullptr;
+			_pike = nullptr;
+			_dfa = nullptr;
+			_onepass = nullptr;
+			_bitparallel = nullptr;
+			_backtrack = nullptr;
+			_jit = nullptr;
+			_span_vm = nullptr;
+			_fill = nullptr;
+			_starts = nullptr;
+			_skip = nullptr;
+			_rev_prog = nullptr;
+			_rev_dfa = nullptr;
+			_suffix_text = nullptr;
+			_suffix_size = 0;
+			_suffix_from = 0;
+			_dfa_ends = false;
+			_begin_line = false;
+			_begin_string = false;
+			_end_line = false;
 		}
 
-		Regex(string pattern, bool caseSensitive = true)
+		Regex(string pattern, bool caseSensitive = true, unsigned int flags = NONE)
 		{
 			_pattern_str = pattern;
+			_pattern = nullptr;
+			_bare = nullptr;
+			_flags = flags;
+			_prog = nullptr;
+			_pike = nullptr;
+			_dfa = nullptr;
+			_onepass = nullptr;
+			_bitparallel = nullptr;
+			_backtrack = nullptr;
+			_jit = nullptr;
+			_span_vm = nullptr;
+			_fill = nullptr;
+			_starts = nullptr;
+			_skip = nullptr;
+			_rev_prog = nullptr;
+			_rev_dfa = nullptr;
+			_suffix_text = nullptr;
+			_suffix_size = 0;
+			_suffix_from = 0;
+			_dfa_ends = false;
+			_begin_line = false;
+			_begin_string = false;
+			_end_line = false;
 			if (pattern.size() > 0)
 			{
-				vector<Token> toks = Lexer::lex(pattern);
-				_pattern = Parser::parse(toks, caseSensitive, _numGroups);
+				if (_flags & LITERAL)
+				{
+					vector<string> strings = split_lines(pattern);
+					_pattern = Parser::literal(strings, caseSensitive, _numGroups);
+
+					vector<string> nonempty;
+					for (size_t i = 0; i < strings.size(); i++)
+					{
+						if (!strings[i].empty())
+						{
+							_literals.push_back(LiteralSearcher(strings[i], caseSensitive));
+							nonempty.push_back(strings[i]);
+						}
+					}
+
+					// Teddy compares exact bytes, so case insensitive strings are searched for one at a time
+					if (nonempty.size() > 1 && caseSensitive)
+						_starts = Teddy::build(nonempty);
+				}
+				else
+				{
+					vector<Token> toks = Lexer::lex(pattern);
+					_pattern = Parser::parse(toks, caseSensitive, _numGroups);
+
+					unsigned short bareGroups;
+					_bare = Parser::parse(toks, caseSensitive, bareGroups, false);
+				}
+
 				_state = MatchState(_numGroups);
 				_minLen = _pattern->min_length();
 				if (_minLen > 0)
 					_minLen--;
+
+				// Without case, the literals are found in the folded text and searched for in either case
+				bool fold = !caseSensitive;
+				_prefix = LiteralSearcher(Analysis::literal_prefix(_pattern, fold), caseSensitive);
+
+				string required = Analysis::required_literal(_pattern, fold);
+				if (required.size() > _prefix.needle().size())
+					_required = LiteralSearcher(required, caseSensitive);
+
+				// A short shared prefix like the "E" of ERROR|EMERG still leaves plenty of false starts, so the branches are searched for together.
+				// The strings of a LITERAL pattern are already searched for whole, which prefixes found without case can't stand in for
+				if (_prefix.needle().size() < 2 && _starts == nullptr && _literals.empty())
+				{
+					vector<string> starts = Analysis::prefix_literals(_pattern);
+					if (starts.size() > 1)
+						_starts = Teddy::build(starts);
+				}
+
+				_maxLen = Analysis::max_length(_pattern);
+				_begin_string = Analysis::anchored_start(_pattern, false);
+				_begin_line = !_begin_string && Analysis::anchored_start(_pattern, true);
+				_end_line = Analysis::anchored_end(_pattern);
+
+				CharSet first = Analysis::first_bytes(_pattern);
+				if (_prefix.empty() && _starts == nullptr && first.count() < 256)
+				{
+					first.invert();
+					_skip = new RunScanner(first);
+				}
+
+				_prog = Compiler::compile(_pattern, _numGroups);
+				if (_flags & LINEAR)
+				{
+					if (_prog == nullptr)
+					{
+						delete _pattern;
+						delete _bare;
+						delete _starts;
+						delete _skip;
+						throw RegexException("Pattern is too large for the linear time engine, or uses possessive quantifiers or atomic groups");
+					}
+
+					_pike = new PikeVM(_prog);
+				}
+
+				if (_prog != nullptr)
+				{
+					_dfa = new LazyDFA(_prog);
+					_bitparallel = BitParallel::build(_prog);
+
+					if (_flags & JIT)
+						_jit = Jit::compile(_prog);
+
+					// The native code only finds where a match ends, so the interpreter fills in the groups
+					if (_flags & (BYTECODE | JIT))
+						_backtrack = new Backtracker(_prog);
+
+					// A group that can match more than once keeps every capture, which the one-pass DFA can't record
+					if (!_prog->repeated_groups)
+						_onepass = OnePass::build(_prog);
+
+					// Left to themselves the atoms don't always find the match the DFAs and the compiled engines do
+					if (!(_flags & (LINEAR | LITERAL)))
+						_span_vm = new PikeVM(_prog);
+
+					if (_span_vm != nullptr && _backtrack == nullptr)
+						_fill = new Backtracker(_prog);
+
+					if (_pike == nullptr)
+					{
+						_rev_prog = Compiler::compile(_pattern, _numGroups, true);
+						if (_rev_prog != nullptr)
+							_rev_dfa = new LazyDFA(_rev_prog);
+
+						_dfa_ends = !_prog->has_empty_loops();
+					}
+
+					// Without anything to find at the start, a literal at the end is the next best thing to search for.
+					// Each search scans back from the last one though, so it's only worth it when the DFAs can't find the ends
+					string suffix = Analysis::literal_suffix(_pattern, fold);
+					if (_rev_dfa != nullptr && !_dfa_ends && _prefix.empty() && _starts == nullptr && !_begin_line && !_begin_string && suffix.size() >= 2)
+						_suffix = LiteralSearcher(suffix, caseSensitive);
+				}
 			}
 			else
 				throw RegexException("Regex pattern cannot be empty");
@@ -48,71 +599,326 @@ namespace rex
 			return _pattern_str;
 		}
 
+		/// <summary>
+		/// Bound the work each search may do, so a hostile text fails fast instead of stalling the caller. A search that goes
+		/// past a limit throws RegexLimitException instead of returning. Only backtracking counts against the limits: the
+		/// atoms and the bytecode interpreter check them as they go, and the JIT isn't used while a limit is set.
+		/// The DFAs and the Pike VM take linear time anyway, so they aren't limited
+		/// </summary>
+		/// <param name="steps">The most backtracking steps a search may take, 0 for no limit</param>
+		/// <param name="millis">The most milliseconds a search may take, 0 for no limit</param>
+		void set_limits(size_t steps, unsigned int millis)
+		{
+			_state.set_limits(steps, millis);
+		}
+
 		/// <summary>
 		/// Attempt to match the regex at the specified start location only, not counting 0 length matches as success
 		/// </summary>
 		/// <param name="str">The string to match</param>
-		/// <param name="out_match">The Match object to hold the results</param>
+		/// <param name="out_match">The Match object to hold the results. Its captures refer to str rather than copying it, see Match::own</param>
 		/// <param name="pos">The position to match at</param>
 		/// <returns>True if the match succeeds, false otherwise</returns>
 		bool matchAt(const char * str, size_t strSize, Match &out_match, size_t pos)
 		{
-			int r = _pattern->try_match(str, strSize, pos, _state);
-			if (r > 0)
+			_state.begin_search();
+			if (_backtrack != nullptr)
+				_backtrack->new_text();
+			if (_jit != nullptr)
+				_jit->new_text();
+
+			return match_here(str, strSize, out_match, pos);
+		}
+
+		/// <summary>
+		/// Attempt to match the regex anywhere in the string, starting at the specified start location and working right until a match is found
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="out_match">The Match object to hold the results. Its captures refer to str rather than copying it, see Match::own</param>
+		/// <param name="The position in the string to start checking at"></param>
+		/// <param name="groups">Fill in the capture groups. Without them only group 0 is recorded, which the DFAs can find on their own</param>
+		/// <returns></returns>
+		bool match(const char *str, size_t strSize, Match& out_match, size_t start_pos = 0, bool groups = true)
+		{
+			// The compiled engines find where the match is before its groups are filled in, so a pattern finds the same matches
+			// with or without groups in it
+			if (!_literals.empty() || !groups || span_first(strSize, start_pos))
+			{
+				size_t start, end;
+				if (!find_span(str, strSize, start, end, start_pos))
+					return false;
+
+				if (!groups || _numGroups == 1)
+				{
+					out_match.add_group_capture(0, Capture(str, start, end - start));
+					return true;
+				}
+
+				_state.begin_search();
+				if (_onepass == nullptr && fill_between(str, strSize, start, end))
+				{
+					_state.commit(out_match, str, strSize);
+					return true;
+				}
+
+				// The atoms couldn't find it, so the VM fills in the groups instead
+				if (_onepass != nullptr ? !_onepass->search(str, strSize, start, _slots) : !_span_vm->search(str, strSize, start, true, _slots))
+					return false;
+
+				commit_slots(str, out_match);
+				return true;
+			}
+
+			if (!may_match(str, strSize, start_pos))
+				return false;
+
+			start_pos = next_start(str, strSize, start_pos);
+			if (start_pos == NO_POS)
+				return false;
+
+			if (_pike != nullptr)
 			{
-				_state.commit(out_match, str);	// Commit will reset the state object
+				// The VM tries every start position in a single pass
+				if (!_pike->search(str, strSize, start_pos, false, _slots))
+					return false;
+
+				commit_slots(str, out_match);
 				return true;
 			}
+
+			if (_rev_dfa != nullptr)
+			{
+				// Only the span the DFAs find is handed to an engine that tracks groups, if any are wanted
+				size_t start, end;
+				LazyDFA::Result r = find_bounds(str, strSize, start_pos, start, end);
+				if (r == LazyDFA::NOT_FOUND)
+					return false;
+
+				if (r == LazyDFA::FOUND)
+				{
+					if (end != NO_POS && _numGroups == 1)
+					{
+						out_match.add_group_capture(0, Capture(str, start, end - start));
+						return true;
+					}
+
+					start_pos = start;
+				}
+			}
+
+			_state.begin_search();
+			if (_backtrack != nullptr)
+				_backtrack->new_text();
+			if (_jit != nullptr)
+				_jit->new_text();
+
+			for (; start_pos != NO_POS; start_pos = next_start(str, strSize, start_pos + 1))
+			{
+				if (match_here(str, strSize, out_match, start_pos))
+					return true;
+			}
 			
 			return false;
 		}
 
 		/// <summary>
-		/// Attempt to match the regex anywhere in the string, starting at the specified start location and working right until a match is found
+		/// Check if the regex matches anywhere in the string, without recording where or filling in any groups. The DFAs answer
+		/// for the same program that decides where match() finds its matches, so the two always agree
 		/// </summary>
 		/// <param name="str">The string to match</param>
-		/// <param name="out_match">The Match object to hold the results</param>
-		/// <param name="The position in the string to start checking at"></param>
-		/// <returns></returns>
-		bool match(const char *str, size_t strSize, Match& out_match, size_t start_pos = 0)
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The position in the string to start checking at</param>
+		/// <returns>True if there is a match</returns>
+		bool is_match(const char* str, size_t strSize, size_t start_pos = 0)
+		{
+			if (!_literals.empty())
+			{
+				size_t len;
+				return find_literal(str, strSize, start_pos, len) != NO_POS;
+			}
+
+			if (!may_match(str, strSize, start_pos))
+				return false;
+
+			start_pos = next_start(str, strSize, start_pos);
+			if (start_pos == NO_POS)
+				return false;
+
+			size_t end;
+			if (_bitparallel != nullptr)
+				return _bitparallel->search(str, strSize, start_pos, false, end);
+
+			if (_dfa != nullptr)
+			{
+				LazyDFA::Result r = _dfa->search(str, strSize, start_pos, false, true, end);
+				if (r != LazyDFA::GAVE_UP)
+					return r == LazyDFA::FOUND;
+			}
+
+			// No DFA, or it ran out of memory on this input
+			size_t start;
+			return find_span(str, strSize, start, end, start_pos);
+		}
+
+		/// <summary>
+		/// Find where the first match at or after start_pos starts and ends, without filling in any groups. It's the same match
+		/// match() would find. Nothing is allocated once the engines have warmed up, and the engines that track groups only track group 0
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="match_start">Receives where the match starts</param>
+		/// <param name="match_end">Receives where the match ends</param>
+		/// <param name="start_pos">The position in the string to start checking at</param>
+		/// <returns>True if there is a match</returns>
+		bool find_span(const char* str, size_t strSize, size_t& match_start, size_t& match_end, size_t start_pos = 0)
 		{
-			for (; start_pos + _minLen < strSize; start_pos++)
+			if (!_literals.empty())
+			{
+				size_t len;
+				match_start = find_literal(str, strSize, start_pos, len);
+				if (match_start == NO_POS)
+					return false;
+
+				match_end = match_start + len;
+				return true;
+			}
+
+			if (!may_match(str, strSize, start_pos))
+				return false;
+
+			start_pos = next_start(str, strSize, start_pos);
+			if (start_pos == NO_POS)
+				return false;
+
+			if (_rev_dfa != nullptr)
+			{
+				LazyDFA::Result r = find_bounds(str, strSize, start_pos, match_start, match_end);
+				if (r == LazyDFA::NOT_FOUND)
+					return false;
+
+				if (r == LazyDFA::FOUND)
+				{
+					if (match_end != NO_POS)
+						return true;
+
+					start_pos = match_start;
+				}
+			}
+
+			// One pass of the VM finds the leftmost match, where the DFAs couldn't
+			PikeVM* vm = _pike != nullptr ? _pike : span_first(strSize, start_pos) ? _span_vm : nullptr;
+			if (vm != nullptr)
+			{
+				if (!vm->search(str, strSize, start_pos, false, _slots))
+					return false;
+
+				match_start = _slots[0];
+				match_end = _slots[1];
+				return true;
+			}
+
+			_state.begin_search();
+			if (_backtrack != nullptr)
+				_backtrack->new_text();
+			if (_jit != nullptr)
+				_jit->new_text();
+
+			for (; start_pos != NO_POS; start_pos = next_start(str, strSize, start_pos + 1))
 			{
-				if (matchAt(str, strSize, out_match, start_pos))
+				if (span_here(str, strSize, start_pos, match_start, match_end))
 					return true;
 			}
-			
+
 			return false;
 		}
 
+		/// <summary>
+		/// Count the matches in the string, the same ones matches() would find, without recording any of them
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="start_pos">The position in the string to start checking at</param>
+		/// <returns>The number of matches</returns>
+		size_t count_matches(const char* str, size_t strSize, size_t start_pos = 0)
+		{
+			size_t count = 0;
+			size_t start, end;
+			while (start_pos + _minLen < strSize && find_span(str, strSize, start, end, start_pos))
+			{
+				count++;
+				start_pos = end > start ? end : start + 1;	//Always move forward by at least 1
+			}
+
+			return count;
+		}
+
 		/// <summary>
 		/// Attempts to match the regex as many times as possible in the string
 		/// </summary>
 		/// <param name="str">The string to match</param>
 		/// <param name="The position in the string to start checking at"></param>
-		/// <returns>A vector of matches made</returns>
-		vector<Match> matches(char *str, size_t strSize, size_t start_pos = 0)
+		/// <param name="groups">Fill in the capture groups of each match, not just group 0</param>
+		/// <returns>A vector of matches made, which refer to str</returns>
+		vector<Match> matches(char *str, size_t strSize, size_t start_pos = 0, bool groups = true)
 		{
 			vector<Match> res;
 			while (start_pos + _minLen < strSize)
 			{
 				Match m;
-				if (matchAt(str, strSize, m, start_pos))
-				{
-					res.push_back(m);
-					size_t len = m.get_group(0).length();
-					start_pos += len == 0 ? 1 : len;	//Always move forward by at least 1
-				}
-				else
-					start_pos++;
+				if (!match(str, strSize, m, start_pos, groups))
+					break;
+
+				res.push_back(m);
+				size_t len = m.get_group(0).length();
+				start_pos = m.start() + (len == 0 ? 1 : len);	//Always move forward by at least 1
 			}
 
 			return res;
 		}
 
+		/// <summary>
+		/// Attempts to match the regex as many times as possible in the string, keeping the results in a MatchList instead of a
+		/// Match each. One Match is reused to find them, so a list that's reused doesn't allocate once it's grown to fit
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="out_matches">Cleared, then receives the matches, which refer to str</param>
+		/// <param name="The position in the string to start checking at"></param>
+		/// <param name="groups">Fill in the capture groups of each match, not just group 0</param>
+		/// <returns>The number of matches made</returns>
+		size_t matches(const char* str, size_t strSize, MatchList& out_matches, size_t start_pos = 0, bool groups = true)
+		{
+			out_matches.clear(str);
+			while (start_pos + _minLen < strSize)
+			{
+				_scratch.clear();
+				if (!match(str, strSize, _scratch, start_pos, groups))
+					break;
+
+				out_matches.add(_scratch);
+				size_t len = _scratch.length();
+				start_pos = _scratch.start() + (len == 0 ? 1 : len);	//Always move forward by at least 1
+			}
+
+			return out_matches.size();
+		}
+
 		~Regex()
 		{
 			delete _pattern;
+			delete _bare;
+			delete _pike;
+			delete _dfa;
+			delete _onepass;
+			delete _bitparallel;
+			delete _backtrack;
+			delete _jit;
+			delete _span_vm;
+			delete _fill;
+			delete _starts;
+			delete _skip;
+			delete _rev_dfa;
+			delete _rev_prog;
+			delete _prog;
 		}
 	};
 }
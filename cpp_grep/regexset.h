@@ -0,0 +1,268 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "lexer.h"
+#include "parser.h"
+#include "program.h"
+#include "compiler.h"
+#include "lazydfa.h"
+#include "regex.h"
+#include "RegexException.h"
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Checks many patterns against the same text in a single pass, such as a list of alert rules run over every log line.
+	/// The patterns are compiled side by side into one Program whose MATCH instructions say which pattern they finish, and one
+	/// lazy DFA over it reports every pattern that matches anywhere in the text.
+	/// A DFA state holds a thread for every pattern partway through a match, so some mixes of patterns have more states than
+	/// the cache can hold. When a DFA gives up on a text, its patterns are split between two new DFAs that are searched instead.
+	/// Patterns that can't be compiled, and texts a DFA over a single pattern gives up on, are checked with a Regex per pattern.
+	/// </summary>
+	class RegexSet
+	{
+	private:
+		// Each DFA tracks many patterns at once, so it gets a bigger state cache than a single Regex
+		static const size_t DFA_MEMORY = 8 * 1024 * 1024;
+
+		vector<string> _patterns;
+		bool _caseSensitive;
+		vector<Program*> _parts;		// Each pattern compiled on its own, or null if it can't be
+		vector<Program*> _progs;
+		vector<LazyDFA*> _dfas;
+		vector<vector<size_t> > _members;	// The patterns in each program
+		vector<size_t> _uncompiled;		// The patterns that are always checked on their own
+		vector<Regex*> _regexes;		// Built the first time a pattern has to be checked on its own
+		vector<bool> _found;
+
+		// RegexSet owns its compiled patterns, so it can't be copied
+		RegexSet(const RegexSet&);
+		RegexSet& operator=(const RegexSet&);
+
+		/// <summary>
+		/// Copy a compiled pattern onto the end of the combined program, moving its jumps and classes past the ones already there
+		/// </summary>
+		static void append(Program& prog, const Program& part, size_t id)
+		{
+			int base = static_cast<int>(prog.insts.size());
+			int class_base = static_cast<int>(prog.classes.size());
+
+			for (size_t i = 0; i < part.insts.size(); i++)
+			{
+				Inst in = part.insts[i];
+				if (in.out >= 0)
+					in.out += base;
+
+				switch (in.op)
+				{
+				case Inst::SPLIT:
+					in.arg += base;
+					break;
+				case Inst::CLASS:
+					in.arg += class_base;
+					break;
+				case Inst::MATCH:
+					in.arg = static_cast<int>(id);
+					break;
+				default:
+					break;
+				}
+
+				prog.insts.push_back(in);
+			}
+
+			prog.classes.insert(prog.classes.end(), part.classes.begin(), part.classes.end());
+		}
+
+		/// <summary>
+		/// Build the combined program and DFA for some of the patterns, and insert them at index 'at'.
+		/// Instruction 0 splits into the first pattern and the next split, and so on down the list
+		/// </summary>
+		void combine(size_t at, const vector<size_t>& ids)
+		{
+			Program* prog = new Program(1);
+			prog->pattern_set = true;
+
+			size_t splits = ids.size() - 1;
+			size_t start = splits;
+			for (size_t i = 0; i < splits; i++)
+			{
+				int next = i + 1 < splits ? static_cast<int>(i + 1) : static_cast<int>(start + _parts[ids[i]]->insts.size());
+				prog->insts.push_back(Inst(Inst::SPLIT, static_cast<int>(start), next));
+				start += _parts[ids[i]]->insts.size();
+			}
+
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				append(*prog, *_parts[ids[i]], ids[i]);
+			}
+
+			_progs.insert(_progs.begin() + at, prog);
+			_dfas.insert(_dfas.begin() + at, new LazyDFA(prog, DFA_MEMORY));
+			_members.insert(_members.begin() + at, ids);
+		}
+
+		/// <summary>
+		/// Replace a DFA by two over half of its patterns each
+		/// </summary>
+		void split(size_t d)
+		{
+			vector<size_t> members;
+			members.swap(_members[d]);
+			delete _dfas[d];
+			delete _progs[d];
+			_dfas.erase(_dfas.begin() + d);
+			_progs.erase(_progs.begin() + d);
+			_members.erase(_members.begin() + d);
+
+			vector<size_t>::iterator half = members.begin() + members.size() / 2;
+			combine(d, vector<size_t>(half, members.end()));
+			combine(d, vector<size_t>(members.begin(), half));
+		}
+
+		/// <summary>
+		/// Check one pattern on its own
+		/// </summary>
+		bool match_one(size_t id, const char* str, size_t strSize)
+		{
+			if (_regexes[id] == nullptr)
+				_regexes[id] = new Regex(_patterns[id], _caseSensitive);
+
+			return _regexes[id]->is_match(str, strSize);
+		}
+
+		void release()
+		{
+			for (size_t i = 0; i < _dfas.size(); i++)
+			{
+				delete _dfas[i];
+			}
+			for (size_t i = 0; i < _progs.size(); i++)
+			{
+				delete _progs[i];
+			}
+			for (size_t i = 0; i < _parts.size(); i++)
+			{
+				delete _parts[i];
+				delete _regexes[i];
+			}
+		}
+
+	public:
+		/// <summary>
+		/// Compile a list of patterns. A pattern's id is its index in the list
+		/// </summary>
+		/// <param name="patterns">The patterns, in the same syntax Regex takes</param>
+		/// <param name="caseSensitive">Applies to every pattern</param>
+		RegexSet(const vector<string>& patterns, bool caseSensitive = true)
+		{
+			_patterns = patterns;
+			_caseSensitive = caseSensitive;
+			_parts = vector<Program*>(patterns.size(), nullptr);
+			_regexes = vector<Regex*>(patterns.size(), nullptr);
+			_found = vector<bool>(patterns.size(), false);
+
+			try
+			{
+				vector<size_t> compiled;
+				for (size_t i = 0; i < patterns.size(); i++)
+				{
+					if (patterns[i].empty())
+						throw RegexException("Regex pattern cannot be empty");
+
+					unsigned short numGroups;
+					Atom* root = Parser::parse(Lexer::lex(patterns[i]), caseSensitive, numGroups);
+					_parts[i] = Compiler::compile(root, numGroups);
+					delete root;
+
+					if (_parts[i] == nullptr)
+						_uncompiled.push_back(i);
+					else
+						compiled.push_back(i);
+				}
+
+				if (!compiled.empty())
+					combine(0, compiled);
+			}
+			catch (...)
+			{
+				release();
+				throw;
+			}
+		}
+
+		size_t size() const
+		{
+			return _patterns.size();
+		}
+
+		const string& get_pattern(size_t id) const
+		{
+			return _patterns[id];
+		}
+
+		/// <summary>
+		/// Find which patterns match somewhere in the string
+		/// </summary>
+		/// <param name="str">The string to match</param>
+		/// <param name="strSize">The length of the string</param>
+		/// <param name="ids">Receives the ids of the patterns that match, in increasing order</param>
+		/// <param name="first_only">Stop as soon as any pattern matches. Only the patterns matching at that point are reported</param>
+		/// <returns>True if any pattern matches</returns>
+		bool match(const char* str, size_t strSize, vector<size_t>& ids, bool first_only = false)
+		{
+			ids.clear();
+			size_t d = 0;
+			while (d < _dfas.size() && !(first_only && !ids.empty()))
+			{
+				if (_dfas[d]->search_set(str, strSize, first_only, _found, ids) == LazyDFA::GAVE_UP)
+				{
+					// Too many states for the cache on this text. Whatever it found still stands, and the patterns it found stay
+					// flagged so the DFAs searched in its place don't report them again
+					if (_members[d].size() > 1)
+					{
+						split(d);
+						continue;
+					}
+
+					size_t id = _members[d][0];
+					if (!_found[id] && match_one(id, str, strSize))
+						ids.push_back(id);
+				}
+
+				d++;
+			}
+
+			for (size_t i = 0; i < ids.size(); i++)
+			{
+				_found[ids[i]] = false;
+			}
+
+			for (size_t i = 0; i < _uncompiled.size() && !(first_only && !ids.empty()); i++)
+			{
+				if (match_one(_uncompiled[i], str, strSize))
+					ids.push_back(_uncompiled[i]);
+			}
+
+			sort(ids.begin(), ids.end());
+			return !ids.empty();
+		}
+
+		/// <summary>
+		/// Check if any of the patterns match somewhere in the string
+		/// </summary>
+		bool is_match(const char* str, size_t strSize)
+		{
+			vector<size_t> ids;
+			return match(str, strSize, ids, true);
+		}
+
+		~RegexSet()
+		{
+			release();
+		}
+	};
+}
@@ -0,0 +1,200 @@
+#pragma once
+#include <cstring>
+#include "charset.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REX_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#define REX_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Measures how many bytes in a row belong to a set, like the run matched by \w+ or [^,]*.
+	/// A set with only a few members, or missing only a few bytes, compares 16 bytes at a time against those bytes with SSE2.
+	/// Any other set is tested 16 bytes at a time with SSSE3 shuffles over the bitmap, or one byte at a time without it.
+	/// </summary>
+	class RunScanner
+	{
+	private:
+		static const size_t MAX_BYTES = 3;
+
+		enum Mode
+		{
+			ALL,		// Every byte is in the set
+			MEMBERS,	// The run ends at the first byte that isn't one of _bytes
+			STOPS,		// The run ends at the first byte that is one of _bytes
+			BITMAP
+		};
+
+		CharSet _set;
+		Mode _mode;
+		unsigned char _bytes[MAX_BYTES];
+		size_t _num_bytes;
+		unsigned char _low_rows[16];	// Bit h is set when the byte with high nibble h and this low nibble is in the set, for h < 8
+		unsigned char _high_rows[16];	// The same for high nibbles 8 to 15
+
+		void collect(const CharSet& set, bool member)
+		{
+			_num_bytes = 0;
+			for (unsigned int c = 0; c < 256; c++)
+			{
+				if (set.contains(static_cast<unsigned char>(c)) == member)
+					_bytes[_num_bytes++] = static_cast<unsigned char>(c);
+			}
+		}
+
+		size_t run_scalar(const char* str, size_t len, size_t pos) const
+		{
+			while (pos < len && _set.contains(static_cast<unsigned char>(str[pos])))
+				pos++;
+			return pos;
+		}
+
+		/// <summary>
+		/// Find the offset of the first clear bit in a 16 bit movemask, or 16 if they are all set
+		/// </summary>
+		static size_t first_clear(unsigned int mask)
+		{
+			size_t n = 0;
+			for (; n < 16 && (mask & 1u); n++, mask >>= 1);
+			return n;
+		}
+
+#ifdef REX_SSE2
+		size_t run_sse2(const char* str, size_t len) const
+		{
+			__m128i bytes[MAX_BYTES];
+			for (size_t i = 0; i < _num_bytes; i++)
+			{
+				bytes[i] = _mm_set1_epi8(static_cast<char>(_bytes[i]));
+			}
+
+			size_t pos = 0;
+			for (; pos + 16 <= len; pos += 16)
+			{
+				__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos));
+				__m128i hit = _mm_cmpeq_epi8(chunk, bytes[0]);
+				for (size_t i = 1; i < _num_bytes; i++)
+				{
+					hit = _mm_or_si128(hit, _mm_cmpeq_epi8(chunk, bytes[i]));
+				}
+
+				// A set bit marks a byte that continues the run
+				unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(hit));
+				if (_mode == STOPS)
+					mask ^= 0xFFFFu;
+
+				if (mask != 0xFFFFu)
+					return pos + first_clear(mask);
+			}
+
+			return run_scalar(str, len, pos);
+		}
+#endif
+
+#ifdef REX_SSSE3
+		size_t run_ssse3(const char* str, size_t len) const
+		{
+			const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+			const __m128i seven = _mm_set1_epi8(7);
+			const __m128i low_rows = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_low_rows));
+			const __m128i high_rows = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_high_rows));
+			const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+
+			size_t pos = 0;
+			for (; pos + 16 <= len; pos += 16)
+			{
+				__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos));
+				__m128i lo = _mm_and_si128(chunk, low_nibbles);
+				__m128i hi = _mm_and_si128(_mm_srli_epi16(chunk, 4), low_nibbles);
+
+				// Pick the bitmap row for each byte's low nibble, then the bit for its high nibble
+				__m128i upper = _mm_cmpgt_epi8(hi, seven);
+				__m128i row = _mm_or_si128(_mm_andnot_si128(upper, _mm_shuffle_epi8(low_rows, lo)), _mm_and_si128(upper, _mm_shuffle_epi8(high_rows, lo)));
+				__m128i bit = _mm_shuffle_epi8(bits, hi);
+
+				unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit)));
+				if (mask != 0xFFFFu)
+					return pos + first_clear(mask);
+			}
+
+			return run_scalar(str, len, pos);
+		}
+#endif
+
+	public:
+		RunScanner(const CharSet& set)
+		{
+			_set = set;
+			_num_bytes = 0;
+			memset(_low_rows, 0, sizeof(_low_rows));
+			memset(_high_rows, 0, sizeof(_high_rows));
+
+			size_t count = set.count();
+			if (count == 256)
+				_mode = ALL;
+			else if (count <= MAX_BYTES)
+			{
+				_mode = MEMBERS;
+				collect(set, true);
+			}
+			else if (count >= 256 - MAX_BYTES)
+			{
+				_mode = STOPS;
+				collect(set, false);
+			}
+			else
+			{
+				_mode = BITMAP;
+				for (unsigned int c = 0; c < 256; c++)
+				{
+					if (!set.contains(static_cast<unsigned char>(c)))
+						continue;
+
+					if (c < 128)
+						_low_rows[c & 15] |= static_cast<unsigned char>(1u << (c >> 4));
+					else
+						_high_rows[c & 15] |= static_cast<unsigned char>(1u << ((c >> 4) - 8));
+				}
+			}
+		}
+
+		/// <summary>
+		/// Count the bytes at the start of str that are in the set
+		/// </summary>
+		/// <param name="len">The most bytes to look at</param>
+		size_t run(const char* str, size_t len) const
+		{
+			switch (_mode)
+			{
+			case ALL:
+				return len;
+
+			case MEMBERS:
+			case STOPS:
+				if (_num_bytes == 0)
+					return 0;	// The empty set
+#ifdef REX_SSE2
+				return run_sse2(str, len);
+#else
+				return run_scalar(str, len, 0);
+#endif
+
+			default:
+#ifdef REX_SSSE3
+				return run_ssse3(str, len);
+#else
+				return run_scalar(str, len, 0);
+#endif
+			}
+		}
+	};
+}
@@ -0,0 +1,197 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstring>
+#include "program.h"
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#define REX_SSSE3
+#include <tmmintrin.h>
+#endif
+
+namespace rex
+{
+	using namespace std;
+
+	/// <summary>
+	/// Finds the leftmost occurrence of any of a set of literals, such as the branches of ERROR|FATAL|PANIC|OOM.
+	/// Each literal goes into one of 8 buckets, and the first few bytes of every literal are recorded in nibble masks: for each
+	/// byte offset, which buckets allow each low nibble and each high nibble. With SSSE3 two shuffles per offset turn 16 input
+	/// bytes into 16 bucket masks at once, and only positions with a bucket left over are compared against the literals in it.
+	/// Without SSSE3 the same filter runs one byte at a time through full 256 entry tables.
+	/// </summary>
+	class Teddy
+	{
+	private:
+		static const size_t MAX_LITERALS = 64;
+		static const size_t MAX_OFFSETS = 3;	// How many leading bytes of each literal the filter looks at
+
+		vector<string> _literals;
+		size_t _offsets;				// Leading bytes used by the filter, limited by the shortest literal
+		size_t _min_len;
+
+		unsigned char _lo[MAX_OFFSETS][16];		// Buckets allowing each low nibble, per offset
+		unsigned char _hi[MAX_OFFSETS][16];		// Buckets allowing each high nibble, per offset
+		unsigned char _table[MAX_OFFSETS][256];	// Buckets allowing each byte, per offset
+
+		Teddy()
+		{
+			memset(_lo, 0, sizeof(_lo));
+			memset(_hi, 0, sizeof(_hi));
+			memset(_table, 0, sizeof(_table));
+			_offsets = 0;
+			_min_len = 0;
+		}
+
+		/// <summary>
+		/// Check the literals in the given buckets against the text at pos
+		/// </summary>
+		/// <returns>The index of the first literal listed that occurs at pos, or -1</returns>
+		int verify(const char* str, size_t strSize, size_t pos, unsigned int buckets) const
+		{
+			for (size_t i = 0; i < _literals.size(); i++)
+			{
+				if (!(buckets & (1u << (i % 8))))
+					continue;
+
+				const string& lit = _literals[i];
+				if (pos + lit.size() <= strSize && memcmp(str + pos, lit.data(), lit.size()) == 0)
+					return static_cast<int>(i);
+			}
+			return -1;
+		}
+
+		size_t find_scalar(const char* str, size_t strSize, size_t from, size_t& which) const
+		{
+			for (size_t pos = from; pos + _min_len <= strSize; pos++)
+			{
+				unsigned int buckets = 0xFF;
+				for (size_t k = 0; k < _offsets && buckets != 0; k++)
+				{
+					buckets &= _table[k][static_cast<unsigned char>(str[pos + k])];
+				}
+
+				if (buckets != 0)
+				{
+					int i = verify(str, strSize, pos, buckets);
+					if (i >= 0)
+					{
+						which = static_cast<size_t>(i);
+						return pos;
+					}
+				}
+			}
+
+			return NO_POS;
+		}
+
+#ifdef REX_SSSE3
+		size_t find_ssse3(const char* str, size_t strSize, size_t from, size_t& which) const
+		{
+			const __m128i low_nibbles = _mm_set1_epi8(0x0F);
+			const __m128i zero = _mm_setzero_si128();
+
+			__m128i lo[MAX_OFFSETS];
+			__m128i hi[MAX_OFFSETS];
+			for (size_t k = 0; k < _offsets; k++)
+			{
+				lo[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_lo[k]));
+				hi[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(_hi[k]));
+			}
+
+			// Each block tests the 16 start positions pos to pos + 15, reading _offsets bytes from each
+			size_t pos = from;
+			for (; pos + 16 + _offsets <= strSize + 1; pos += 16)
+			{
+				__m128i res = _mm_set1_epi8(static_cast<char>(0xFF));
+				for (size_t k = 0; k < _offsets; k++)
+				{
+					__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + pos + k));
+					__m128i l = _mm_shuffle_epi8(lo[k], _mm_and_si128(chunk, low_nibbles));
+					__m128i h = _mm_shuffle_epi8(hi[k], _mm_and_si128(_mm_srli_epi16(chunk, 4), low_nibbles));
+					res = _mm_and_si128(res, _mm_and_si128(l, h));
+				}
+
+				unsigned int candidates = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(res, zero))) ^ 0xFFFFu;
+				if (candidates == 0)
+					continue;
+
+				unsigned char buckets[16];
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(buckets), res);
+				for (size_t bit = 0; candidates != 0; bit++, candidates >>= 1)
+				{
+					if (!(candidates & 1u))
+						continue;
+
+					int i = verify(str, strSize, pos + bit, buckets[bit]);
+					if (i >= 0)
+					{
+						which = static_cast<size_t>(i);
+						return pos + bit;
+					}
+				}
+			}
+
+			return find_scalar(str, strSize, pos, which);
+		}
+#endif
+
+	public:
+		/// <summary>
+		/// Build the masks for a set of literals
+		/// </summary>
+		/// <returns>The searcher, or null if there are too many literals or one of them is empty</returns>
+		static Teddy* build(const vector<string>& literals)
+		{
+			if (literals.empty() || literals.size() > MAX_LITERALS)
+				return nullptr;
+
+			size_t min_len = literals[0].size();
+			for (size_t i = 1; i < literals.size(); i++)
+			{
+				if (literals[i].size() < min_len)
+					min_len = literals[i].size();
+			}
+			if (min_len == 0)
+				return nullptr;
+
+			Teddy* t = new Teddy();
+			t->_literals = literals;
+			t->_min_len = min_len;
+			t->_offsets = min_len < MAX_OFFSETS ? min_len : MAX_OFFSETS;
+
+			for (size_t i = 0; i < literals.size(); i++)
+			{
+				unsigned char bucket = static_cast<unsigned char>(1u << (i % 8));
+				for (size_t k = 0; k < t->_offsets; k++)
+				{
+					unsigned char c = static_cast<unsigned char>(literals[i][k]);
+					t->_lo[k][c & 0x0F] |= bucket;
+					t->_hi[k][c >> 4] |= bucket;
+					t->_table[k][c] |= bucket;
+				}
+			}
+
+			return t;
+		}
+
+		const string& literal(size_t i) const
+		{
+			return _literals[i];
+		}
+
+		/// <summary>
+		/// Find the leftmost occurrence of any literal starting at or after from. At a tie the literal listed first wins
+		/// </summary>
+		/// <param name="which">Receives the index of the literal found</param>
+		/// <returns>The position of the occurrence, or NO_POS</returns>
+		size_t find(const char* str, size_t strSize, size_t from, size_t& which) const
+		{
+#ifdef REX_SSSE3
+			return find_ssse3(str, strSize, from, which);
+#else
+			return find_scalar(str, strSize, from, which);
+#endif
+		}
+	};
+}
@@ -27,13 +27,18 @@ namespace rex
 			LAZY_PLUS,				// +?
 			LAZY_STAR,				// *?
 			LAZY_Q_MARK,			// ??
+			POSSESSIVE_PLUS,		// ++
+			POSSESSIVE_STAR,		// *+
+			POSSESSIVE_Q_MARK,		// ?+
 			STATIC_QUAN,
 			GREEDY_MIN_QUAN,
 			LAZY_MIN_QUAN,
+			POSSESSIVE_MIN_QUAN,
 			GREEDY_RANGE_QUAN,
 			LAZY_RANGE_QUAN,
+			POSSESSIVE_RANGE_QUAN,
 
-			START_GROUP,			// ( or (?:
+			START_GROUP,			// ( or (?: or (?>
 			END_GROUP				// )
 		};
 
@@ -58,7 +63,7 @@ namespace rex
 
 		bool isQuan()
 		{
-			return type >= GREEDY_PLUS && type <= LAZY_RANGE_QUAN;
+			return type >= GREEDY_PLUS && type <= POSSESSIVE_RANGE_QUAN;
 		}
 
 		string toString()
@@ -105,6 +110,15 @@ namespace rex
 			case LAZY_STAR:
 				val += "LAZY_STAR";
 				break;
+			case POSSESSIVE_PLUS:
+				val += "POSSESSIVE_PLUS";
+				break;
+			case POSSESSIVE_Q_MARK:
+				val += "POSSESSIVE_Q_MARK";
+				break;
+			case POSSESSIVE_STAR:
+				val += "POSSESSIVE_STAR";
+				break;
 			case LITERAL:
 				val += "LITERAL";
 				break;
@@ -114,6 +128,9 @@ namespace rex
 			case LAZY_MIN_QUAN:
 				val += "LAZY_MIN_QUAN";
 				break;
+			case POSSESSIVE_MIN_QUAN:
+				val += "POSSESSIVE_MIN_QUAN";
+				break;
 			case OR_OP:
 				val += "OR_OP";
 				break;
@@ -123,6 +140,9 @@ namespace rex
 			case LAZY_RANGE_QUAN:
 				val += "LAZY_RANGE_QUAN";
 				break;
+			case POSSESSIVE_RANGE_QUAN:
+				val += "POSSESSIVE_RANGE_QUAN";
+				break;
 			case SPECIAL:
 				val += "SPECIAL";
 				break;
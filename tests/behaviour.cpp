@@ -0,0 +1,180 @@
+// behaviour.cpp : Checks what the options and APIs that engine_diff can't compare against another engine actually do.
+//
+// Build and run from the repository root:
+//     g++ -Icpp_grep tests/behaviour.cpp cpp_grep/MatchState.cpp -o behaviour && ./behaviour
+// Prints each check that fails, and exits with 1 if there were any.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "regex.h"
+#include "regexset.h"
+
+using namespace std;
+using namespace rex;
+
+static int failures = 0;
+
+static void expect(const string& what, const string& got, const string& expected)
+{
+	if (got == expected)
+		return;
+
+	failures++;
+	printf("%s gives %s, but should give %s\n", what.c_str(), got.c_str(), expected.c_str());
+}
+
+/// <summary>
+/// Describe every capture of every group of a match, like engine_diff does
+/// </summary>
+static string captures_of(const Match& m)
+{
+	string s;
+	for (unsigned short g = 0; g < m.total_groups(); g++)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%sg%u", g > 0 ? "; " : "", static_cast<unsigned int>(g));
+		s += buf;
+
+		const Group& group = m.group(g);
+		for (size_t c = 0; c < group.total_caps(); c++)
+		{
+			snprintf(buf, sizeof(buf), " %lu+%lu", static_cast<unsigned long>(group.capture(c).start()), static_cast<unsigned long>(group.capture(c).length()));
+			s += buf;
+		}
+	}
+	return s;
+}
+
+/// <summary>
+/// Check the first match of a pattern in a text
+/// </summary>
+static void expect_match(const string& pattern, const string& text, const string& expected, bool caseSensitive = true, unsigned int flags = Regex::NONE)
+{
+	Regex regex(pattern, caseSensitive, flags);
+	Match m;
+	string got = regex.match(text.data(), text.size(), m) ? captures_of(m) : "no match";
+	expect("/" + pattern + "/ on \"" + text + "\"", got, expected);
+}
+
+/// <summary>
+/// Check the patterns of a RegexSet that match a text, as a list of their ids
+/// </summary>
+static void expect_set(const vector<string>& patterns, const string& text, const string& expected, bool caseSensitive = true)
+{
+	RegexSet set(patterns, caseSensitive);
+	vector<size_t> ids;
+	set.match(text.data(), text.size(), ids);
+
+	string got;
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%s%lu", i > 0 ? " " : "", static_cast<unsigned long>(ids[i]));
+		got += buf;
+	}
+	expect("RegexSet on \"" + text + "\"", got, expected);
+}
+
+/// <summary>
+/// Check that a search goes past the limits it was given
+/// </summary>
+static void expect_limit(Regex& regex, const string& what, const string& text)
+{
+	Match m;
+	string got = "no exception";
+	try
+	{
+		got = regex.match(text.data(), text.size(), m) ? "a match" : "no match";
+	}
+	catch (const RegexLimitException&)
+	{
+		got = "RegexLimitException";
+	}
+	expect(what, got, "RegexLimitException");
+}
+
+int main()
+{
+	// Possessive quantifiers and atomic groups never give back what they matched
+	expect_match("a*+a", "aaa", "no match");
+	expect_match("a*+b", "aab", "g0 0+3");
+	expect_match("(a|b){1,3}+b", "abab", "g0 0+4; g1 0+1 1+1 2+1");
+	expect_match("(a|b){1,3}+b", "aab", "no match");
+	expect_match("(?>a|ab)c", "abc", "no match");
+	expect_match("(?>ab|a)c", "abc", "g0 0+3");
+	expect_match("(?>(x)?)b", "cxcb", "g0 3+1");
+
+	// Fixed strings, where the characters that mean something in a regex don't
+	expect_match("a.b", "axb a.b", "g0 4+3", true, Regex::LITERAL);
+	expect_match("x*\nfoo", "foo x*", "g0 0+3", true, Regex::LITERAL);
+	expect_match("foo\nBAR", "xx bar foo", "g0 7+3", true, Regex::LITERAL);
+	expect_match("foo\nBAR", "xx bar foo", "g0 3+3", false, Regex::LITERAL);
+	expect_match("fOo", "FOOD", "g0 0+3", false, Regex::LITERAL);
+	expect_match("fOo", "FOOD", "no match", true, Regex::LITERAL);
+	expect_match("[a-z]+", "ABC", "g0 0+3", false);
+	expect_match("[a-z]+", "ABC", "no match", true, Regex::JIT);
+	expect_match("[a-z]+", "ABC", "g0 0+3", false, Regex::LINEAR);
+
+	// The MatchList from matches() holds each match with all of its captures
+	{
+		Regex regex("(\\w)(\\d)?");
+		string text = "a1 b c2";
+		MatchList list;
+		char count[32];
+		snprintf(count, sizeof(count), "%lu", static_cast<unsigned long>(regex.matches(text.data(), text.size(), list)));
+		expect("matches() on \"" + text + "\"", count, "3");
+
+		static const char* expected[] = { "g0 0+2; g1 0+1; g2 1+1", "g0 3+1; g1 3+1", "g0 5+2; g1 5+1; g2 6+1" };
+		for (size_t i = 0; i < list.size() && i < 3; i++)
+		{
+			Match m;
+			list.get(i, m);
+			expect("MatchList entry " + string(1, static_cast<char>('0' + i)), captures_of(m), expected[i]);
+		}
+	}
+
+	// A RegexSet gives the id of every pattern that matches somewhere in the text
+	{
+		vector<string> patterns;
+		patterns.push_back("foo");
+		patterns.push_back("ba+r");
+		patterns.push_back("^x");
+		patterns.push_back("\\d");
+		expect_set(patterns, "a baar foo", "0 1");
+		expect_set(patterns, "x1", "2 3");
+		expect_set(patterns, "FOO", "");
+		expect_set(patterns, "FOO BAR", "0 1", false);
+	}
+
+	// A search that goes past its step limit gives up with an exception, and the next search starts afresh
+	{
+		Regex regex("(a|b|ab)*c", true, Regex::BYTECODE);
+		regex.set_limits(50, 0);
+		string text;
+		for (int i = 0; i < 1000; i++)
+		{
+			text += "ab";
+		}
+		text += "c";
+		expect_limit(regex, "A step limit of 50", text);
+		Match m;
+		string got = regex.match("abc", 3, m) ? captures_of(m) : "no match";
+		expect("The search after the step limit", got, "g0 0+3; g1 0+1 1+1");
+	}
+
+	// An atomic group keeps this on the atoms, which take seconds to try every way of splitting the a's between the a*s
+	{
+		Regex regex("(?>x?)(a*)a*a*a*a*c");
+		regex.set_limits(0, 1);
+		expect_limit(regex, "A time limit of 1ms", string(60, 'a') + "bc");
+
+		regex.set_limits(0, 0);
+		Match m;
+		string got = regex.match("aac", 3, m) ? captures_of(m) : "no match";
+		expect("The search after the time limit", got, "g0 0+3; g1 0+2");
+	}
+
+	printf("%d failure(s)\n", failures);
+	return failures > 0 ? 1 : 0;
+}
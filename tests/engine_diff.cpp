@@ -0,0 +1,507 @@
+// engine_diff.cpp : Checks that the engines find the same matches as each other.
+//
+// Build and run from the repository root:
+//     g++ -Icpp_grep tests/engine_diff.cpp cpp_grep/MatchState.cpp -o engine_diff && ./engine_diff [seed]
+// Prints each difference it finds, and exits with 1 if there were any.
+//
+// Random patterns run on the default engine and on BYTECODE, JIT and LINEAR, with and without case. LITERAL patterns are
+// checked against the same strings written as a regex, possessive quantifiers against the atomic groups they stand for, and
+// a RegexSet against a Regex for each of its patterns.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "regex.h"
+#include "regexset.h"
+
+using namespace std;
+using namespace rex;
+
+static string random_alternation(int depth);
+
+static string random_quantifier()
+{
+	static const char* quantifiers[] = { "*", "+", "?", "*?", "+?", "{2}", "{1,3}", "{0,2}?", "{2,}" };
+	int q = rand() % 12;
+	return q < 9 ? quantifiers[q] : "";
+}
+
+static string random_atom(int depth)
+{
+	int r = rand() % 14;
+	if (depth > 1 && r >= 9)
+		r = rand() % 9;
+
+	switch (r)
+	{
+	case 0:
+	case 1:
+	case 2:
+		return string(1, "abc"[rand() % 3]) + random_quantifier();
+	case 3:
+		return "." + random_quantifier();
+	case 4:
+		return "[ab]" + random_quantifier();
+	case 5:
+		return "[^a]" + random_quantifier();
+	case 6:
+		return "\\d" + random_quantifier();
+	case 7:
+	{
+		static const char* anchors[] = { "^", "$", "\\b", "\\B" };
+		return anchors[rand() % 4];
+	}
+	case 8:
+		return "x" + random_quantifier();
+	case 9:
+	case 10:
+		return "(" + random_alternation(depth + 1) + ")" + random_quantifier();
+	case 11:
+	case 12:
+		return "(?:" + random_alternation(depth + 1) + ")" + random_quantifier();
+	default:
+		return "\\w" + random_quantifier();
+	}
+}
+
+static string random_alternation(int depth)
+{
+	string s;
+	for (int n = 1 + rand() % 3; n > 0; n--)
+	{
+		s += random_atom(depth);
+	}
+
+	if (rand() % 3 == 0)
+		s += "|" + random_alternation(depth + 1);
+	return s;
+}
+
+static string random_text()
+{
+	string s;
+	for (int n = rand() % 24; n > 0; n--)
+	{
+		s.push_back("aabbc1xA \n"[rand() % 10]);
+	}
+	return s;
+}
+
+static string describe(bool found, size_t start, size_t length)
+{
+	char buf[64];
+	if (!found)
+		return "no match";
+
+	snprintf(buf, sizeof(buf), "%lu+%lu", static_cast<unsigned long>(start), static_cast<unsigned long>(length));
+	return buf;
+}
+
+static int differences = 0;
+
+static void report(const string& pattern, const string& text, size_t pos, const string& what, const string& got, const string& other, const string& expected)
+{
+	if (differences++ >= 20)
+		return;
+
+	string shown;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		shown += text[i] == '\n' ? string("\\n") : string(1, text[i]);
+	}
+
+	printf("/%s/ on \"%s\" from %lu: %s gives %s, but %s gives %s\n", pattern.c_str(), shown.c_str(), static_cast<unsigned long>(pos),
+		what.c_str(), got.c_str(), other.c_str(), expected.c_str());
+}
+
+/// <summary>
+/// What to call the engine a set of Regex::Flags picks, in a report
+/// </summary>
+static string engine_name(unsigned int flags, bool caseSensitive)
+{
+	string name = flags & Regex::LINEAR ? "LINEAR" : flags & Regex::JIT ? "JIT" : flags & Regex::BYTECODE ? "BYTECODE"
+		: flags & Regex::LITERAL ? "LITERAL" : "the default engine";
+	return caseSensitive ? name : name + " ignoring case";
+}
+
+/// <summary>
+/// Describe every capture of every group of a match, or only the last capture of each group
+/// </summary>
+static string captures_of(const Match& m, bool last_only = false)
+{
+	string s;
+	for (unsigned short g = 0; g < m.total_groups(); g++)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%sg%u", g > 0 ? "; " : "", static_cast<unsigned int>(g));
+		s += buf;
+
+		const Group& group = m.group(g);
+		for (size_t c = last_only && group.total_caps() > 0 ? group.total_caps() - 1 : 0; c < group.total_caps(); c++)
+		{
+			s += " " + describe(true, group.capture(c).start(), group.capture(c).length());
+		}
+	}
+	return s;
+}
+
+/// <summary>
+/// Find the first match at or after pos with match(), and describe it with all of its captures
+/// </summary>
+static string match_of(Regex* regex, const string& text, size_t pos, Match& m, bool last_only = false)
+{
+	if (!regex->match(text.data(), text.size(), m, pos))
+		return "no match";
+
+	return captures_of(m, last_only);
+}
+
+/// <summary>
+/// Find where the first match at or after pos is with find_span(), described the way group 0 is by captures_of
+/// </summary>
+static string span_of(Regex* regex, const string& text, size_t pos)
+{
+	size_t start, end;
+	if (!regex->find_span(text.data(), text.size(), start, end, pos))
+		return "no match";
+
+	return "g0 " + describe(true, start, end - start);
+}
+
+/// <summary>
+/// Group 0 of a description from match_of, or "no match"
+/// </summary>
+static string group0(const string& captures)
+{
+	size_t end = captures.find(';');
+	return end == string::npos ? captures : captures.substr(0, end);
+}
+
+static string count_of(size_t count)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lu", static_cast<unsigned long>(count));
+	return buf;
+}
+
+/// <summary>
+/// Check that a regex agrees with its own match(): is_match() and find_span() from every start position, count_matches()
+/// and the number of matches() over the text, and that the MatchList from matches() holds the same matches, with the same
+/// captures, as calling match() for each one
+/// </summary>
+static void check_self(Regex* regex, const string& name, const string& pattern, const string& text)
+{
+	for (size_t pos = 0; pos <= text.size(); pos++)
+	{
+		Match m;
+		string found = match_of(regex, text, pos, m);
+
+		string span = span_of(regex, text, pos);
+		if (span != group0(found))
+			report(pattern, text, pos, name + " find_span()", span, "match()", found);
+
+		string is = regex->is_match(text.data(), text.size(), pos) ? "a match" : "no match";
+		if (is != (found == "no match" ? "no match" : "a match"))
+			report(pattern, text, pos, name + " is_match()", is, "match()", found);
+	}
+
+	MatchList list;
+	string listed = count_of(regex->matches(text.data(), text.size(), list));
+	string counted = count_of(regex->count_matches(text.data(), text.size()));
+	if (listed != counted)
+		report(pattern, text, 0, name + " matches()", listed, "count_matches()", counted);
+
+	size_t pos = 0;
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		Match m;
+		string expected = match_of(regex, text, pos, m);
+		Match entry;
+		list.get(i, entry);
+		string got = captures_of(entry);
+		if (got != expected)
+		{
+			report(pattern, text, pos, name + " MatchList", got, "match()", expected);
+			return;
+		}
+
+		pos = m.start() + (m.length() == 0 ? 1 : m.length());
+	}
+}
+
+/// <summary>
+/// Compare the default engine with the one flags picks on a pattern and text, from every start position, down to the captures
+/// of every group. The Pike VM only keeps the last capture of each group, so LINEAR is only held to those
+/// </summary>
+static void compare(const string& pattern, const string& text, unsigned int flags, bool caseSensitive = true)
+{
+	Regex* def;
+	Regex* other;
+	try
+	{
+		def = new Regex(pattern, caseSensitive);
+	}
+	catch (const RegexException&)
+	{
+		return;
+	}
+
+	// LINEAR turns down the patterns the VM can't run
+	try
+	{
+		other = new Regex(pattern, caseSensitive, flags);
+	}
+	catch (const RegexException&)
+	{
+		delete def;
+		return;
+	}
+
+	string name = engine_name(flags, caseSensitive);
+	string expected_name = engine_name(Regex::NONE, caseSensitive);
+	bool last_only = (flags & Regex::LINEAR) != 0;
+	for (size_t pos = 0; pos <= text.size(); pos++)
+	{
+		Match a, b;
+		string expected = match_of(def, text, pos, a, last_only);
+		string got = match_of(other, text, pos, b, last_only);
+		if (got != expected)
+			report(pattern, text, pos, name + " match()", got, expected_name, expected);
+	}
+
+	string expected = count_of(def->count_matches(text.data(), text.size()));
+	string got = count_of(other->count_matches(text.data(), text.size()));
+	if (got != expected)
+		report(pattern, text, 0, name + " count_matches()", got, expected_name, expected);
+
+	check_self(other, name, pattern, text);
+
+	delete def;
+	delete other;
+}
+
+/// <summary>
+/// Check a pattern on a text with the default engine, then compare it with every other engine
+/// </summary>
+static void check(const string& pattern, const string& text, bool caseSensitive = true)
+{
+	try
+	{
+		Regex def(pattern, caseSensitive);
+		check_self(&def, engine_name(Regex::NONE, caseSensitive), pattern, text);
+	}
+	catch (const RegexException&)
+	{
+		return;
+	}
+
+	compare(pattern, text, Regex::BYTECODE, caseSensitive);
+	compare(pattern, text, Regex::JIT, caseSensitive);
+	compare(pattern, text, Regex::LINEAR, caseSensitive);
+}
+
+/// <summary>
+/// Compare a LITERAL pattern with the same strings written as an alternation. Where several strings match at the same place,
+/// both take the one listed first
+/// </summary>
+static void compare_literal(const vector<string>& strings, const string& text, bool caseSensitive)
+{
+	string lines, alternation;
+	for (size_t i = 0; i < strings.size(); i++)
+	{
+		lines += (i > 0 ? "\n" : "") + strings[i];
+		alternation += i > 0 ? "|" : "";
+		for (size_t c = 0; c < strings[i].size(); c++)
+		{
+			if (strings[i][c] == '.' || strings[i][c] == '*')
+				alternation += "\\";
+			alternation += strings[i][c];
+		}
+	}
+
+	Regex literal(lines, caseSensitive, Regex::LITERAL);
+	Regex regex(alternation, caseSensitive);
+	string name = engine_name(Regex::LITERAL, caseSensitive);
+	for (size_t pos = 0; pos <= text.size(); pos++)
+	{
+		Match a, b;
+		string expected = match_of(&regex, text, pos, a);
+		string got = match_of(&literal, text, pos, b);
+		if (got != expected)
+			report(alternation, text, pos, name + " match()", got, "the regex", expected);
+	}
+
+	check_self(&literal, name, alternation, text);
+}
+
+/// <summary>
+/// Make a pattern with possessive quantifiers in it, and the same pattern with each of them written as an atomic group
+/// </summary>
+static void random_possessive(string& possessive, string& atomic)
+{
+	static const char* quantifiers[] = { "*", "+", "?", "{1,3}", "{2,}" };
+	possessive.clear();
+	atomic.clear();
+	for (int n = 1 + rand() % 3; n > 0; n--)
+	{
+		if (rand() % 2 == 0)
+		{
+			string plain = random_atom(2);
+			possessive += plain;
+			atomic += plain;
+			continue;
+		}
+
+		static const char* atoms[] = { "a", "b", "[ab]", ".", "\\w", "x" };
+		string inner = rand() % 3 == 0 ? "(" + random_alternation(2) + ")" : atoms[rand() % 6];
+		const char* q = quantifiers[rand() % 5];
+		possessive += inner + q + "+";
+		atomic += "(?>" + inner + q + ")";
+	}
+}
+
+/// <summary>
+/// Compare a pattern with possessive quantifiers with the same pattern written with atomic groups
+/// </summary>
+static void compare_possessive(const string& possessive, const string& atomic, const string& text)
+{
+	Regex* a;
+	Regex* b;
+	try
+	{
+		a = new Regex(possessive);
+	}
+	catch (const RegexException&)
+	{
+		return;
+	}
+	b = new Regex(atomic);
+
+	for (size_t pos = 0; pos <= text.size(); pos++)
+	{
+		Match ma, mb;
+		string got = match_of(a, text, pos, ma);
+		string expected = match_of(b, text, pos, mb);
+		if (got != expected)
+			report(possessive, text, pos, "match()", got, atomic, expected);
+	}
+
+	check_self(a, engine_name(Regex::NONE, true), possessive, text);
+	check_self(b, engine_name(Regex::NONE, true), atomic, text);
+	delete a;
+	delete b;
+}
+
+/// <summary>
+/// Compare the patterns a RegexSet finds in a text with the ones a Regex for each of them finds
+/// </summary>
+static void compare_set(const vector<string>& patterns, const string& text, bool caseSensitive)
+{
+	RegexSet set(patterns, caseSensitive);
+	vector<size_t> ids;
+	bool any = set.match(text.data(), text.size(), ids);
+
+	bool expected_any = false;
+	for (size_t i = 0; i < patterns.size(); i++)
+	{
+		Regex regex(patterns[i], caseSensitive);
+		bool expected = regex.is_match(text.data(), text.size());
+		bool got = false;
+		for (size_t j = 0; j < ids.size(); j++)
+		{
+			got = got || ids[j] == i;
+		}
+
+		expected_any = expected_any || expected;
+		if (got != expected)
+			report(patterns[i], text, 0, "RegexSet", got ? "a match" : "no match", "Regex", expected ? "a match" : "no match");
+	}
+
+	if (any != expected_any || set.is_match(text.data(), text.size()) != expected_any)
+		report(patterns[0] + "|...", text, 0, "RegexSet is_match()", any ? "a match" : "no match", "Regex", expected_any ? "a match" : "no match");
+}
+
+int main(int argc, char* argv[])
+{
+	// Patterns that gave a different group 0 depending on whether their groups capture
+	check("[^a]?\?((.b)a)*", "c aab1");
+	check("[^a]?\?(?:(?:.b)a)*", "c aab1");
+	check("([a-c]?[ab])*[ab]", "Aaa bxc");
+	check("(?:[a-c]?[ab])*[ab]", "Aaa bxc");
+	check("(a|ab)*c", "abc");
+
+	// A failed try of the atoms left its captures behind for the next match
+	check("(a(a|.+|\\B.{2}B?){0,2}?[ab]|x*?)|[ab]*?|\\w+[ab]{2,}.{1,3}", "b1a  cabA1cb");
+
+	// Quantifiers over atoms that can match nothing
+	check("(x*?)*", "bx");
+	check("(x*?)*?y", "xy");
+
+	// Iterations that match nothing still capture, like they do in the program
+	check("x(a?)?", "xA");
+	check("(.*){1,3}", "abc");
+	check("(a?){0,3}b", "aab");
+
+	srand(argc > 1 ? static_cast<unsigned int>(atoi(argv[1])) : 1);
+	for (int i = 0; i < 2000; i++)
+	{
+		string pattern = random_alternation(0);
+		bool caseSensitive = rand() % 4 != 0;
+		for (int t = 0; t < 3; t++)
+		{
+			check(pattern, random_text(), caseSensitive);
+		}
+	}
+
+	for (int i = 0; i < 1000; i++)
+	{
+		vector<string> strings;
+		for (int n = 1 + rand() % 4; n > 0; n--)
+		{
+			string s;
+			for (int len = 1 + rand() % 3; len > 0; len--)
+			{
+				s.push_back("aAbB1 .*"[rand() % 8]);
+			}
+			strings.push_back(s);
+		}
+
+		string text;
+		for (int n = rand() % 24; n > 0; n--)
+		{
+			text.push_back("aAbB1 .*"[rand() % 8]);
+		}
+		compare_literal(strings, text, rand() % 2 == 0);
+	}
+
+	for (int i = 0; i < 1000; i++)
+	{
+		string possessive, atomic;
+		random_possessive(possessive, atomic);
+		for (int t = 0; t < 3; t++)
+		{
+			compare_possessive(possessive, atomic, random_text());
+		}
+	}
+
+	for (int i = 0; i < 500; i++)
+	{
+		vector<string> patterns;
+		for (int n = 1 + rand() % 5; n > 0; n--)
+		{
+			patterns.push_back(random_alternation(1));
+		}
+
+		try
+		{
+			compare_set(patterns, random_text(), rand() % 2 == 0);
+		}
+		catch (const RegexException&)
+		{
+		}
+	}
+
+	printf("%d difference(s)\n", differences);
+	return differences > 0 ? 1 : 0;
+}